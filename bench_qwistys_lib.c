@@ -0,0 +1,172 @@
+// Allocator overhead and throughput on many small live objects
+//
+//   gcc -O2 -DNDEBUG -Iinc bench_qwistys_lib.c inc/*.c -o bench -lpthread
+//   gcc -O2 -DNDEBUG -DQWISTYS_ALLOC_COMPACT -Iinc bench_qwistys_lib.c inc/*.c -o bench_compact -lpthread
+//
+// Overhead per object is what the allocator holds beyond the requested bytes:
+// header, footer, alignment padding and the unused end of the slab slot.
+//
+// The last section shares one stack between threads: the lock-free
+// qwistys_cstack_t against a qwistys_stack_t behind a mutex.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "qwistys_macros.h"
+#include "qwistys_alloc.h"
+#include "qwistys_avltree.h"
+#include "qwistys_cstack.h"
+#include "qwistys_stack.h"
+
+#define BENCH_OBJECTS 1000000
+#define BENCH_THREADS 4
+#define BENCH_STACK_OPS 1000000
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void bench_report(const char* name, size_t live, double alloc_seconds, double free_seconds,
+                         qwistys_alloc_stats_t* stats) {
+    printf("%-14s live %8zu  usage %10zu  footprint %10zu  overhead %6.2f B/object  "
+           "alloc %6.1f ns  free %6.1f ns\n",
+           name, live, stats->current_usage, stats->current_footprint,
+           (double)(stats->current_footprint - stats->current_usage) / (double)live,
+           alloc_seconds * 1e9 / (double)live, free_seconds * 1e9 / (double)live);
+}
+
+static void bench_objects(void** objects, size_t size) {
+    qwistys_alloc_stats_t base;
+    qwistys_alloc_stats_t stats;
+    qwistys_alloc_get_stats(&base);
+
+    double start = bench_now();
+    for (size_t i = 0; i < BENCH_OBJECTS; i++) {
+        objects[i] = qwistys_malloc(size, NULL);
+    }
+    double allocated = bench_now();
+    qwistys_alloc_get_stats(&stats);
+    stats.current_usage -= base.current_usage;
+    stats.current_footprint -= base.current_footprint;
+
+    double freeing = bench_now();
+    for (size_t i = 0; i < BENCH_OBJECTS; i++) {
+        qwistys_free(objects[i]);
+    }
+    double freed = bench_now();
+
+    char name[32];
+    snprintf(name, sizeof(name), "malloc(%zu)", size);
+    bench_report(name, BENCH_OBJECTS, allocated - start, freed - freeing, &stats);
+}
+
+static int bench_cmp(void* a, void* b) {
+    uint32_t x = *(uint32_t*)a;
+    uint32_t y = *(uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_avl_tree(void) {
+    qwistys_alloc_stats_t base;
+    qwistys_alloc_stats_t stats;
+    qwistys_alloc_get_stats(&base);
+
+    avlt_node_t* root = NULL;
+    uint32_t key = 1;
+    double start = bench_now();
+    for (size_t i = 0; i < BENCH_OBJECTS; i++) {
+        key = key * 1664525u + 1013904223u; // Distinct keys, full period LCG
+        root = avlt_insert(root, &key, sizeof(key), bench_cmp);
+    }
+    double allocated = bench_now();
+    qwistys_alloc_get_stats(&stats);
+    stats.current_usage -= base.current_usage;
+    stats.current_footprint -= base.current_footprint;
+
+    double freeing = bench_now();
+    avlt_free_tree(root, NULL);
+    double freed = bench_now();
+
+    // Each tree node is two blocks: the node and its key
+    bench_report("avl tree", 2 * BENCH_OBJECTS, allocated - start, freed - freeing, &stats);
+}
+
+typedef struct {
+    qwistys_cstack_t* cstack;
+    qwistys_stack_t* stack;
+    pthread_mutex_t* mutex;
+} bench_shared_t;
+
+// Recycling pattern: take an object, give one back
+static void* bench_cstack_worker(void* arg) {
+    bench_shared_t* shared = (bench_shared_t*)arg;
+    uintptr_t item = 1;
+    for (size_t i = 0; i < BENCH_STACK_OPS; i++) {
+        qwistys_cstack_push(shared->cstack, &item);
+        qwistys_cstack_pop(shared->cstack, &item);
+    }
+    return NULL;
+}
+
+static void* bench_stack_worker(void* arg) {
+    bench_shared_t* shared = (bench_shared_t*)arg;
+    uintptr_t item = 1;
+    for (size_t i = 0; i < BENCH_STACK_OPS; i++) {
+        pthread_mutex_lock(shared->mutex);
+        qwistys_stack_push(shared->stack, &item);
+        pthread_mutex_unlock(shared->mutex);
+        pthread_mutex_lock(shared->mutex);
+        qwistys_stack_pop(shared->stack, &item);
+        pthread_mutex_unlock(shared->mutex);
+    }
+    return NULL;
+}
+
+static double bench_threads(void* (*worker)(void*), bench_shared_t* shared) {
+    pthread_t threads[BENCH_THREADS];
+    double start = bench_now();
+    for (int i = 0; i < BENCH_THREADS; i++) {
+        pthread_create(&threads[i], NULL, worker, shared);
+    }
+    for (int i = 0; i < BENCH_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return bench_now() - start;
+}
+
+static void bench_shared_stacks(void) {
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    bench_shared_t shared = {qwistys_cstack_init(sizeof(uintptr_t), 64),
+                             qwistys_stack_init(sizeof(uintptr_t), 64), &mutex};
+    double ops = 2.0 * BENCH_THREADS * BENCH_STACK_OPS;
+
+    double lock_free = bench_threads(bench_cstack_worker, &shared);
+    double locked = bench_threads(bench_stack_worker, &shared);
+    printf("%d threads     cstack %6.1f Mops/s  mutex stack %6.1f Mops/s\n", BENCH_THREADS,
+           ops / lock_free * 1e-6, ops / locked * 1e-6);
+
+    qwistys_cstack_free(shared.cstack);
+    qwistys_stack_free(shared.stack);
+}
+
+int main(void) {
+    printf("header %zu B, footer %zu B, alignment %d B\n", sizeof(qwistys_alloc_header_t),
+           sizeof(qwistys_alloc_footer_t), QWISTYS_ALLOC_ALIGNMENT);
+
+    void** objects = (void**)malloc(BENCH_OBJECTS * sizeof(void*));
+    if (!objects) {
+        return 1;
+    }
+    static const size_t sizes[] = {4, 8, 16, 24, 40, 64, 100};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_objects(objects, sizes[i]);
+    }
+    free(objects);
+
+    bench_avl_tree();
+    bench_shared_stacks();
+    return 0;
+}
@@ -1,23 +1,922 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // mremap
+#endif
 #include "qwistys_macros.h"
 #include "qwistys_alloc.h"
+#include <execinfo.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "string.h"
 
-// Global variables for memory tracking
-static size_t total_allocated = 0;
-static size_t total_freed = 0;
-static size_t current_usage = 0;
-static size_t peak_usage = 0;
-
 static qwistys_alloc_error_t qwistys_alloc_error = QWISTYS_ALLOC_SUCCESS;
 
-API_IMPL void* qwistys_alloc_internal(size_t num_of_bytes, user_canary_settings callback) {
+// Header flags layout
+#define QWISTYS_ALLOC_KIND_MASK 0x3u
+#define QWISTYS_ALLOC_KIND_HEAP 0x0u
+#define QWISTYS_ALLOC_KIND_SLAB 0x1u
+#define QWISTYS_ALLOC_KIND_MMAP 0x2u
+#define QWISTYS_ALLOC_SAMPLED 0x4u    // Tracked by the heap profiler
+#define QWISTYS_ALLOC_REGISTERED 0x8u // Has a registry node in front of the header
+#define QWISTYS_ALLOC_ALIGNED 0x10u   // Over-aligned, the word before the header holds its offset
+#ifdef QWISTYS_ALLOC_COMPACT
+#define QWISTYS_ALLOC_CLASS_SHIFT 5
+#define QWISTYS_ALLOC_CLASS_MASK 0x7Fu
+#define QWISTYS_ALLOC_ALIGN_SHIFT 12  // log2 of the alignment of an aligned block
+#define QWISTYS_ALLOC_ALIGN_MASK 0xFu
+#else
+#define QWISTYS_ALLOC_CLASS_SHIFT 8
+#define QWISTYS_ALLOC_CLASS_MASK 0xFFu
+#define QWISTYS_ALLOC_ALIGN_SHIFT 16  // log2 of the alignment of an aligned block
+#define QWISTYS_ALLOC_ALIGN_MASK 0xFFu
+#endif
+
+#define QWISTYS_ALLOC_BLOCK_SIZE(size) \
+    (sizeof(qwistys_alloc_header_t) + QWISTYS_ALLOC_ALIGN(size) + sizeof(qwistys_alloc_footer_t))
+
+// ================================================
+// Slab size classes
+// ================================================
+// Up to QWISTYS_SLAB_SMALL_LIMIT classes grow by QWISTYS_ALLOC_ALIGNMENT,
+// above it every power of two is split in QWISTYS_SLAB_SPLITS classes.
+
+#define QWISTYS_SLAB_SMALL_LIMIT 512
+#define QWISTYS_SLAB_SMALL_SHIFT 9
+#define QWISTYS_SLAB_SPLITS 4
+#define QWISTYS_SLAB_SMALL_CLASSES (QWISTYS_SLAB_SMALL_LIMIT / QWISTYS_ALLOC_ALIGNMENT)
+#define QWISTYS_SLAB_CLASSES (QWISTYS_SLAB_SMALL_CLASSES + 3 * QWISTYS_SLAB_SPLITS)
+
+#if QWISTYS_SLAB_MAX_BLOCK > (QWISTYS_SLAB_SMALL_LIMIT << 3)
+#error "QWISTYS_SLAB_MAX_BLOCK is bigger than the largest slab class"
+#endif
+#if QWISTYS_SLAB_CLASSES > QWISTYS_ALLOC_CLASS_MASK + 1
+#error "Slab classes do not fit in the header flags"
+#endif
+
+typedef struct qwistys_slab_slot_t {
+    struct qwistys_slab_slot_t *next;
+} qwistys_slab_slot_t;
+
+typedef struct {
+    qwistys_slab_slot_t *free_list; // Recycled slots
+    char *bump;                     // Not yet carved part of the current chunk
+    char *end;
+    volatile int lock;
+} qwistys_slab_class_t;
+
+static qwistys_slab_class_t qwistys_slab_classes[QWISTYS_SLAB_CLASSES];
+
+static inline size_t qwistys_slab_class_of(size_t block_size) {
+    if (block_size <= QWISTYS_SLAB_SMALL_LIMIT) {
+        return (block_size + QWISTYS_ALLOC_ALIGNMENT - 1) / QWISTYS_ALLOC_ALIGNMENT - 1;
+    }
+    size_t lg = (sizeof(unsigned long) * 8 - 1) - (size_t)__builtin_clzl((unsigned long)(block_size - 1));
+    size_t step = ((size_t)1 << lg) / QWISTYS_SLAB_SPLITS;
+    return QWISTYS_SLAB_SMALL_CLASSES + (lg - QWISTYS_SLAB_SMALL_SHIFT) * QWISTYS_SLAB_SPLITS +
+           (block_size - 1 - ((size_t)1 << lg)) / step;
+}
+
+static inline size_t qwistys_slab_class_size(size_t class_index) {
+    if (class_index < QWISTYS_SLAB_SMALL_CLASSES) {
+        return (class_index + 1) * QWISTYS_ALLOC_ALIGNMENT;
+    }
+    class_index -= QWISTYS_SLAB_SMALL_CLASSES;
+    size_t base = (size_t)QWISTYS_SLAB_SMALL_LIMIT << (class_index / QWISTYS_SLAB_SPLITS);
+    return base + (base / QWISTYS_SLAB_SPLITS) * (class_index % QWISTYS_SLAB_SPLITS + 1);
+}
+
+static inline void qwistys_slab_lock(qwistys_slab_class_t *slab) {
+    while (__atomic_test_and_set(&slab->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&slab->lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static inline void qwistys_slab_unlock(qwistys_slab_class_t *slab) {
+    __atomic_clear(&slab->lock, __ATOMIC_RELEASE);
+}
+
+// Takes up to max_slots slots of the class in one locked section, recycled
+// ones first, then freshly carved ones. Returns them chained via *head.
+static size_t qwistys_slab_refill(size_t class_index, qwistys_slab_slot_t **head, size_t max_slots) {
+    qwistys_slab_class_t *slab = &qwistys_slab_classes[class_index];
+    size_t slot_size = qwistys_slab_class_size(class_index);
+    qwistys_slab_slot_t *list = NULL;
+    size_t taken = 0;
+
+    qwistys_slab_lock(slab);
+    while (taken < max_slots && slab->free_list) {
+        qwistys_slab_slot_t *slot = slab->free_list;
+        slab->free_list = slot->next;
+        slot->next = list;
+        list = slot;
+        taken++;
+    }
+    while (taken < max_slots) {
+        if ((size_t)(slab->end - slab->bump) < slot_size) {
+            if (taken) {
+                break;
+            }
+            // Chunks are never handed back, their slots live on in the free lists
+            char *chunk = (char *)malloc(QWISTYS_SLAB_CHUNK_SIZE);
+            if (!chunk) {
+                break;
+            }
+            QWISTYS_DEBUG_MSG("New slab chunk for class %zu (%zu bytes)", class_index, slot_size);
+            slab->bump = chunk;
+            slab->end = chunk + QWISTYS_SLAB_CHUNK_SIZE;
+        }
+        qwistys_slab_slot_t *slot = (qwistys_slab_slot_t *)slab->bump;
+        slab->bump += slot_size;
+        slot->next = list;
+        list = slot;
+        taken++;
+    }
+    qwistys_slab_unlock(slab);
+
+    *head = list;
+    return taken;
+}
+
+// Gives a chain of slots back to the class in one locked section
+static void qwistys_slab_release(size_t class_index, qwistys_slab_slot_t *head, qwistys_slab_slot_t *tail) {
+    qwistys_slab_class_t *slab = &qwistys_slab_classes[class_index];
+
+    qwistys_slab_lock(slab);
+    tail->next = slab->free_list;
+    slab->free_list = head;
+    qwistys_slab_unlock(slab);
+}
+
+// ================================================
+// Thread cache and statistics
+// ================================================
+// Every thread owns a cache of free slots per class and its own counters, so
+// the hot path touches no shared cache line. Counters are written by the
+// owner only and summed up by qwistys_alloc_get_stats. The usage delta is
+// pushed to a shared counter every QWISTYS_ALLOC_STATS_BATCH bytes to keep
+// track of the peak, so it is exact for a single thread and off by at most a
+// batch per thread otherwise.
+
+#ifndef QWISTYS_TCACHE_BYTES
+#define QWISTYS_TCACHE_BYTES (64 * 1024)
+#endif
+#ifndef QWISTYS_ALLOC_STATS_BATCH
+#define QWISTYS_ALLOC_STATS_BATCH (64 * 1024)
+#endif
+#define QWISTYS_TCACHE_MIN_SLOTS 8
+#define QWISTYS_TCACHE_MAX_SLOTS 128
+
+typedef struct qwistys_thread_cache_t {
+    qwistys_slab_slot_t *bins[QWISTYS_SLAB_CLASSES];
+    uint32_t counts[QWISTYS_SLAB_CLASSES];
+    size_t allocated;  // Bytes handed out by this thread
+    size_t freed;      // Bytes given back by this thread
+    size_t footprint;  // Backing memory taken minus given back by this thread
+    int64_t pending;   // Usage delta not yet pushed to qwistys_usage
+    int64_t base;      // qwistys_usage as seen by the last push
+    size_t peak;       // Highest base + pending seen by this thread
+    int64_t sample_countdown; // Bytes left until the next profiler sample
+    uint64_t rng;              // Sampling random state, 0 until armed
+    int registered;
+    struct qwistys_thread_cache_t *prev;
+    struct qwistys_thread_cache_t *next;
+} qwistys_thread_cache_t;
+
+static __thread qwistys_thread_cache_t qwistys_tcache;
+
+static pthread_once_t qwistys_tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t qwistys_tcache_key;
+static pthread_mutex_t qwistys_tcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static qwistys_thread_cache_t *qwistys_tcache_list = NULL;
+
+// Counters of threads that already exited
+static size_t qwistys_retired_allocated = 0;
+static size_t qwistys_retired_freed = 0;
+static size_t qwistys_retired_footprint = 0;
+
+static int64_t qwistys_usage = 0;
+static size_t qwistys_peak_usage = 0;
+
+static inline size_t qwistys_tcache_limit(size_t class_index) {
+    size_t limit = QWISTYS_TCACHE_BYTES / qwistys_slab_class_size(class_index);
+    return QWISTYS_MIN(QWISTYS_MAX(limit, QWISTYS_TCACHE_MIN_SLOTS), QWISTYS_TCACHE_MAX_SLOTS);
+}
+
+// Keeps the first (hottest) slots of the bin and gives the rest back
+static void qwistys_tcache_flush(qwistys_thread_cache_t *cache, size_t class_index, size_t keep) {
+    size_t count = cache->counts[class_index];
+    if (count <= keep) {
+        return;
+    }
+    qwistys_slab_slot_t *rest = cache->bins[class_index];
+    if (keep) {
+        qwistys_slab_slot_t *split = rest;
+        for (size_t i = 1; i < keep; i++) {
+            split = split->next;
+        }
+        rest = split->next;
+        split->next = NULL;
+    } else {
+        cache->bins[class_index] = NULL;
+    }
+    qwistys_slab_slot_t *last = rest;
+    for (size_t i = keep + 1; i < count; i++) {
+        last = last->next;
+    }
+    cache->counts[class_index] = (uint32_t)keep;
+    qwistys_slab_release(class_index, rest, last);
+}
+
+static void qwistys_usage_push(qwistys_thread_cache_t *cache) {
+    int64_t usage = __atomic_add_fetch(&qwistys_usage, cache->pending, __ATOMIC_RELAXED);
+    cache->pending = 0;
+    cache->base = usage;
+    size_t peak = __atomic_load_n(&qwistys_peak_usage, __ATOMIC_RELAXED);
+    while (usage > 0 && (size_t)usage > peak &&
+           !__atomic_compare_exchange_n(&qwistys_peak_usage, &peak, (size_t)usage, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+// Runs when a thread exits: slots go back to the classes, counters are retired
+static void qwistys_tcache_destroy(void *arg) {
+    qwistys_thread_cache_t *cache = (qwistys_thread_cache_t *)arg;
+    for (size_t i = 0; i < QWISTYS_SLAB_CLASSES; i++) {
+        qwistys_tcache_flush(cache, i, 0);
+    }
+    qwistys_usage_push(cache);
+    size_t peak = __atomic_load_n(&qwistys_peak_usage, __ATOMIC_RELAXED);
+    while (cache->peak > peak &&
+           !__atomic_compare_exchange_n(&qwistys_peak_usage, &peak, cache->peak, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+
+    pthread_mutex_lock(&qwistys_tcache_lock);
+    qwistys_retired_allocated += cache->allocated;
+    qwistys_retired_freed += cache->freed;
+    qwistys_retired_footprint += cache->footprint;
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        qwistys_tcache_list = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
+    }
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_unlock(&qwistys_tcache_lock);
+}
+
+static void qwistys_tcache_make_key(void) {
+    pthread_key_create(&qwistys_tcache_key, qwistys_tcache_destroy);
+}
+
+static void qwistys_tcache_register(qwistys_thread_cache_t *cache) {
+    pthread_once(&qwistys_tcache_once, qwistys_tcache_make_key);
+    pthread_setspecific(qwistys_tcache_key, cache);
+
+    pthread_mutex_lock(&qwistys_tcache_lock);
+    cache->prev = NULL;
+    cache->next = qwistys_tcache_list;
+    if (qwistys_tcache_list) {
+        qwistys_tcache_list->prev = cache;
+    }
+    qwistys_tcache_list = cache;
+    cache->registered = 1;
+    pthread_mutex_unlock(&qwistys_tcache_lock);
+}
+
+static inline qwistys_thread_cache_t *qwistys_tcache_get(void) {
+    qwistys_thread_cache_t *cache = &qwistys_tcache;
+    if (__builtin_expect(!cache->registered, 0)) {
+        qwistys_tcache_register(cache);
+    }
+    return cache;
+}
+
+static inline void *qwistys_tcache_alloc(qwistys_thread_cache_t *cache, size_t class_index) {
+    qwistys_slab_slot_t *slot = cache->bins[class_index];
+    if (__builtin_expect(!slot, 0)) {
+        size_t taken = qwistys_slab_refill(class_index, &slot, qwistys_tcache_limit(class_index) / 2);
+        if (!taken) {
+            return NULL;
+        }
+        cache->counts[class_index] = (uint32_t)taken;
+    }
+    cache->bins[class_index] = slot->next;
+    cache->counts[class_index]--;
+    return slot;
+}
+
+static inline void qwistys_tcache_free(qwistys_thread_cache_t *cache, void *block, size_t class_index) {
+    qwistys_slab_slot_t *slot = (qwistys_slab_slot_t *)block;
+    slot->next = cache->bins[class_index];
+    cache->bins[class_index] = slot;
+    if (__builtin_expect(++cache->counts[class_index] > qwistys_tcache_limit(class_index), 0)) {
+        qwistys_tcache_flush(cache, class_index, qwistys_tcache_limit(class_index) / 2);
+    }
+}
+
+static inline void qwistys_stats_alloc(qwistys_thread_cache_t *cache, size_t num_of_bytes, size_t footprint) {
+    __atomic_store_n(&cache->allocated, cache->allocated + num_of_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->footprint, cache->footprint + footprint, __ATOMIC_RELAXED);
+    cache->pending += (int64_t)num_of_bytes;
+    int64_t usage = cache->base + cache->pending;
+    if (usage > 0 && (size_t)usage > cache->peak) {
+        __atomic_store_n(&cache->peak, (size_t)usage, __ATOMIC_RELAXED);
+    }
+    if (cache->pending > QWISTYS_ALLOC_STATS_BATCH) {
+        qwistys_usage_push(cache);
+    }
+}
+
+static inline void qwistys_stats_free(qwistys_thread_cache_t *cache, size_t num_of_bytes, size_t footprint) {
+    __atomic_store_n(&cache->freed, cache->freed + num_of_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->footprint, cache->footprint - footprint, __ATOMIC_RELAXED);
+    cache->pending -= (int64_t)num_of_bytes;
+    if (cache->pending < -QWISTYS_ALLOC_STATS_BATCH) {
+        qwistys_usage_push(cache);
+    }
+}
+
+// ================================================
+// Heap profiler
+// ================================================
+// Samples on average one allocation per period bytes, with exponentially
+// distributed gaps so the samples form a Poisson process and pprof can scale
+// them back. A sampled block is flagged in its header and remembered in
+// qwistys_profile_blocks, its stack is accounted to a site.
+
+#define QWISTYS_PROFILE_SITE_BUCKETS 4096
+#define QWISTYS_PROFILE_BLOCK_BUCKETS 4096
+
+typedef struct qwistys_profile_site_t {
+    struct qwistys_profile_site_t *next;
+    size_t live_count;
+    size_t live_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+    int depth;
+    void *stack[QWISTYS_HEAP_PROFILE_DEPTH];
+} qwistys_profile_site_t;
+
+typedef struct qwistys_profile_block_t {
+    struct qwistys_profile_block_t *next;
+    void *pointer;
+    size_t size;
+    qwistys_profile_site_t *site;
+} qwistys_profile_block_t;
+
+static size_t qwistys_sample_period = 0;
+static pthread_mutex_t qwistys_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static qwistys_profile_site_t **qwistys_profile_sites = NULL;
+static qwistys_profile_block_t **qwistys_profile_blocks = NULL;
+
+static inline uint64_t qwistys_profile_random(qwistys_thread_cache_t *cache) {
+    uint64_t x = cache->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    cache->rng = x;
+    return x;
+}
+
+// Exponential gap with the given mean, log2 is approximated linearly
+// between powers of two which is plenty for sampling
+static int64_t qwistys_profile_next_gap(qwistys_thread_cache_t *cache, size_t period) {
+    uint64_t q = (qwistys_profile_random(cache) >> 38) + 1; // 1 .. 2^26
+    int msb = 63 - __builtin_clzll(q);
+    double log2_q = msb + ((double)q / (double)(1ULL << msb) - 1.0);
+    return (int64_t)((26.0 - log2_q) * 0.6931471805599453 * (double)period) + 1;
+}
+
+static inline size_t qwistys_profile_hash(const void *key) {
+    uintptr_t h = (uintptr_t)key;
+    h ^= h >> 17;
+    h *= 0xed5ad4bbU;
+    h ^= h >> 11;
+    return (size_t)h;
+}
+
+static qwistys_profile_site_t *qwistys_profile_site(void **stack, int depth) {
+    size_t h = 0;
+    for (int i = 0; i < depth; i++) {
+        h = h * 31 + qwistys_profile_hash(stack[i]);
+    }
+    qwistys_profile_site_t **bucket = &qwistys_profile_sites[h % QWISTYS_PROFILE_SITE_BUCKETS];
+    for (qwistys_profile_site_t *site = *bucket; site; site = site->next) {
+        if (site->depth == depth && memcmp(site->stack, stack, sizeof(void *) * (size_t)depth) == 0) {
+            return site;
+        }
+    }
+    qwistys_profile_site_t *site = (qwistys_profile_site_t *)calloc(1, sizeof(qwistys_profile_site_t));
+    if (!site) {
+        return NULL;
+    }
+    site->depth = depth;
+    memcpy(site->stack, stack, sizeof(void *) * (size_t)depth);
+    site->next = *bucket;
+    *bucket = site;
+    return site;
+}
+
+__attribute__((noinline)) static void qwistys_profile_record(qwistys_alloc_header_t *header, size_t size) {
+    void *stack[QWISTYS_HEAP_PROFILE_DEPTH + 1];
+    int depth = backtrace(stack, QWISTYS_HEAP_PROFILE_DEPTH + 1) - 1; // Drop this frame
+    void *pointer = (char *)header + sizeof(qwistys_alloc_header_t);
+
+    pthread_mutex_lock(&qwistys_profile_lock);
+    if (qwistys_profile_sites && depth > 0) {
+        qwistys_profile_site_t *site = qwistys_profile_site(stack + 1, depth);
+        qwistys_profile_block_t *block = (qwistys_profile_block_t *)malloc(sizeof(qwistys_profile_block_t));
+        if (site && block) {
+            site->live_count++;
+            site->live_bytes += size;
+            site->alloc_count++;
+            site->alloc_bytes += size;
+            block->pointer = pointer;
+            block->size = size;
+            block->site = site;
+            qwistys_profile_block_t **bucket =
+                &qwistys_profile_blocks[qwistys_profile_hash(pointer) % QWISTYS_PROFILE_BLOCK_BUCKETS];
+            block->next = *bucket;
+            *bucket = block;
+            header->flags |= QWISTYS_ALLOC_SAMPLED;
+        } else {
+            free(block);
+        }
+    }
+    pthread_mutex_unlock(&qwistys_profile_lock);
+}
+
+static inline void qwistys_profile_alloc(qwistys_thread_cache_t *cache, qwistys_alloc_header_t *header, size_t size) {
+    size_t period = __atomic_load_n(&qwistys_sample_period, __ATOMIC_RELAXED);
+    if (__builtin_expect(!period, 1)) {
+        return;
+    }
+    cache->sample_countdown -= (int64_t)size;
+    if (__builtin_expect(cache->sample_countdown >= 0, 1)) {
+        return;
+    }
+    if (__builtin_expect(!cache->rng, 0)) {
+        // First crossing of this thread: seed it and draw the first real gap,
+        // this allocation counts against that gap like any later one
+        cache->rng = qwistys_profile_hash(cache) | 1;
+        cache->sample_countdown = qwistys_profile_next_gap(cache, period) - (int64_t)size;
+        if (cache->sample_countdown >= 0) {
+            return;
+        }
+    }
+    qwistys_profile_record(header, size);
+    cache->sample_countdown = qwistys_profile_next_gap(cache, period);
+}
+
+static void qwistys_profile_free(void *pointer) {
+    pthread_mutex_lock(&qwistys_profile_lock);
+    if (qwistys_profile_blocks) {
+        qwistys_profile_block_t **link =
+            &qwistys_profile_blocks[qwistys_profile_hash(pointer) % QWISTYS_PROFILE_BLOCK_BUCKETS];
+        for (; *link; link = &(*link)->next) {
+            qwistys_profile_block_t *block = *link;
+            if (block->pointer == pointer) {
+                block->site->live_count--;
+                block->site->live_bytes -= block->size;
+                *link = block->next;
+                free(block);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&qwistys_profile_lock);
+}
+
+static void qwistys_profile_clear(void) {
+    if (qwistys_profile_blocks) {
+        for (size_t i = 0; i < QWISTYS_PROFILE_BLOCK_BUCKETS; i++) {
+            while (qwistys_profile_blocks[i]) {
+                qwistys_profile_block_t *next = qwistys_profile_blocks[i]->next;
+                free(qwistys_profile_blocks[i]);
+                qwistys_profile_blocks[i] = next;
+            }
+        }
+    }
+    if (qwistys_profile_sites) {
+        for (size_t i = 0; i < QWISTYS_PROFILE_SITE_BUCKETS; i++) {
+            while (qwistys_profile_sites[i]) {
+                qwistys_profile_site_t *next = qwistys_profile_sites[i]->next;
+                free(qwistys_profile_sites[i]);
+                qwistys_profile_sites[i] = next;
+            }
+        }
+    }
+    free(qwistys_profile_blocks);
+    free(qwistys_profile_sites);
+    qwistys_profile_blocks = NULL;
+    qwistys_profile_sites = NULL;
+}
+
+API_IMPL int qwistys_heap_profile_start(size_t sample_period) {
+    QWISTYS_TELEMETRY_START();
+
+    pthread_mutex_lock(&qwistys_profile_lock);
+    qwistys_profile_clear();
+    qwistys_profile_sites = (qwistys_profile_site_t **)calloc(QWISTYS_PROFILE_SITE_BUCKETS, sizeof(qwistys_profile_site_t *));
+    qwistys_profile_blocks = (qwistys_profile_block_t **)calloc(QWISTYS_PROFILE_BLOCK_BUCKETS, sizeof(qwistys_profile_block_t *));
+    if (!qwistys_profile_sites || !qwistys_profile_blocks) {
+        qwistys_profile_clear();
+        pthread_mutex_unlock(&qwistys_profile_lock);
+        QWISTYS_DEBUG_MSG("Failed to start heap profiler");
+        QWISTYS_TELEMETRY_END();
+        return -1;
+    }
+    __atomic_store_n(&qwistys_sample_period, sample_period ? sample_period : QWISTYS_HEAP_PROFILE_PERIOD,
+                     __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&qwistys_profile_lock);
+
+    QWISTYS_DEBUG_MSG("Heap profiler started");
+    QWISTYS_TELEMETRY_END();
+    return 0;
+}
+
+API_IMPL void qwistys_heap_profile_stop(void) {
+    QWISTYS_TELEMETRY_START();
+
+    pthread_mutex_lock(&qwistys_profile_lock);
+    __atomic_store_n(&qwistys_sample_period, 0, __ATOMIC_RELAXED);
+    qwistys_profile_clear();
+    pthread_mutex_unlock(&qwistys_profile_lock);
+
+    QWISTYS_DEBUG_MSG("Heap profiler stopped");
+    QWISTYS_TELEMETRY_END();
+}
+
+API_IMPL int qwistys_heap_profile_dump(const char* path) {
+    QWISTYS_ASSERT(path != NULL);
+    QWISTYS_TELEMETRY_START();
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        QWISTYS_DEBUG_MSG("Failed to open %s", path);
+        QWISTYS_TELEMETRY_END();
+        return -1;
+    }
+
+    pthread_mutex_lock(&qwistys_profile_lock);
+    size_t totals[4] = {0, 0, 0, 0};
+    if (qwistys_profile_sites) {
+        for (size_t i = 0; i < QWISTYS_PROFILE_SITE_BUCKETS; i++) {
+            for (qwistys_profile_site_t* site = qwistys_profile_sites[i]; site; site = site->next) {
+                totals[0] += site->live_count;
+                totals[1] += site->live_bytes;
+                totals[2] += site->alloc_count;
+                totals[3] += site->alloc_bytes;
+            }
+        }
+    }
+    // gperftools heap profile, readable by pprof
+    fprintf(file, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", totals[0], totals[1], totals[2], totals[3],
+            __atomic_load_n(&qwistys_sample_period, __ATOMIC_RELAXED));
+    if (qwistys_profile_sites) {
+        for (size_t i = 0; i < QWISTYS_PROFILE_SITE_BUCKETS; i++) {
+            for (qwistys_profile_site_t* site = qwistys_profile_sites[i]; site; site = site->next) {
+                fprintf(file, "%zu: %zu [%zu: %zu] @", site->live_count, site->live_bytes, site->alloc_count,
+                        site->alloc_bytes);
+                for (int frame = 0; frame < site->depth; frame++) {
+                    fprintf(file, " %p", site->stack[frame]);
+                }
+                fputc('\n', file);
+            }
+        }
+    }
+    pthread_mutex_unlock(&qwistys_profile_lock);
+
+    fprintf(file, "\nMAPPED_LIBRARIES:\n");
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char buffer[4096];
+        size_t length;
+        while ((length = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+            fwrite(buffer, 1, length, file);
+        }
+        fclose(maps);
+    }
+
+    int result = ferror(file) ? -1 : 0;
+    fclose(file);
+    QWISTYS_TELEMETRY_END();
+    return result;
+}
+
+// ================================================
+// Huge blocks
+// ================================================
+// Blocks of at least the mmap threshold get their own mapping followed by
+// QWISTYS_ALLOC_GUARD_PAGES PROT_NONE pages, and free gives the pages back to
+// the OS. The block is placed at the end of its mapping, the footer ends less
+// than the alignment before the guard, so running off the block faults within
+// a few bytes. The word in front of the header holds the header offset from
+// the mapping start, the mapping length follows from it and the size.
+// A block resized by mremap keeps its offset so the pointer survives, it can
+// end up to a page before the guard until it is allocated again.
+
+static size_t qwistys_mmap_threshold = QWISTYS_ALLOC_MMAP_THRESHOLD;
+static size_t qwistys_page_size = 0;
+
+static inline size_t qwistys_page(void) {
+    size_t page = __atomic_load_n(&qwistys_page_size, __ATOMIC_RELAXED);
+    if (__builtin_expect(!page, 0)) {
+        page = (size_t)sysconf(_SC_PAGESIZE);
+        __atomic_store_n(&qwistys_page_size, page, __ATOMIC_RELAXED);
+    }
+    return page;
+}
+
+static inline size_t qwistys_mmap_data_length(size_t total_size) {
+    size_t page = qwistys_page();
+    return (total_size + page - 1) & ~(page - 1);
+}
+
+static void *qwistys_mmap_alloc(size_t total_size) {
+    size_t data_length = qwistys_mmap_data_length(total_size);
+    size_t guard_length = QWISTYS_ALLOC_GUARD_PAGES * qwistys_page();
+    char *base = (char *)mmap(NULL, data_length + guard_length, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if (guard_length && mprotect(base + data_length, guard_length, PROT_NONE) != 0) {
+        munmap(base, data_length + guard_length);
+        return NULL;
+    }
+    return base;
+}
+
+static void qwistys_mmap_free(void *block, size_t total_size) {
+    munmap(block, qwistys_mmap_data_length(total_size) + QWISTYS_ALLOC_GUARD_PAGES * qwistys_page());
+}
+
+// Moves the guard along with the end of the block, the pages are remapped
+// and never copied. Returns NULL if the mapping could not be resized.
+static void *qwistys_mmap_resize(void *block, size_t old_total, size_t new_total) {
+    size_t old_length = qwistys_mmap_data_length(old_total);
+    size_t new_length = qwistys_mmap_data_length(new_total);
+    size_t guard_length = QWISTYS_ALLOC_GUARD_PAGES * qwistys_page();
+    if (old_length == new_length) {
+        return block;
+    }
+#ifdef MREMAP_MAYMOVE
+    char *base = (char *)block;
+    // One protection over the whole range, mremap does not span mappings
+    if (guard_length && mprotect(base + old_length, guard_length, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+    char *moved = (char *)mremap(base, old_length + guard_length, new_length + guard_length, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED) {
+        if (guard_length) {
+            mprotect(base + old_length, guard_length, PROT_NONE);
+        }
+        return NULL;
+    }
+    if (guard_length) {
+        mprotect(moved + new_length, guard_length, PROT_NONE);
+    }
+    return moved;
+#else
+    (void)guard_length;
+    return NULL;
+#endif
+}
+
+API_IMPL void qwistys_alloc_set_mmap_threshold(size_t num_of_bytes) {
+    __atomic_store_n(&qwistys_mmap_threshold, num_of_bytes, __ATOMIC_RELAXED);
+}
+
+API_IMPL size_t qwistys_alloc_get_mmap_threshold(void) {
+    return __atomic_load_n(&qwistys_mmap_threshold, __ATOMIC_RELAXED);
+}
+
+// ================================================
+// Live block registry
+// ================================================
+// While the registry is enabled every new block starts with a node linking it
+// into one of QWISTYS_REGISTRY_SHARDS lists, picked by address so threads
+// rarely share a lock. qwistys_alloc_scrub walks the lists in bounded slices
+// and checks the canaries of the blocks it passes.
+
+#define QWISTYS_REGISTRY_SHARDS 64
+
+// Sized to keep the header that follows it aligned
+typedef struct qwistys_registry_node_t {
+    struct qwistys_registry_node_t *prev;
+    struct qwistys_registry_node_t *next;
+    void *site;                     // Return address of the allocation call
+    qwistys_alloc_header_t *header;
+    size_t size;                    // Copy of header->size, checked before the footer is trusted
+} __attribute__((aligned(QWISTYS_ALLOC_ALIGNMENT))) qwistys_registry_node_t;
+
+typedef struct {
+    qwistys_registry_node_t *head;
+    qwistys_registry_node_t *cursor; // Next node to scrub
+    int scrubbing;                   // cursor is valid, NULL then means done
+    volatile int lock;
+} __attribute__((aligned(64))) qwistys_registry_shard_t;
+
+static int qwistys_registry_enabled = 0;
+static qwistys_registry_shard_t qwistys_registry[QWISTYS_REGISTRY_SHARDS];
+static pthread_mutex_t qwistys_scrub_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t qwistys_scrub_shard = 0;
+
+static inline qwistys_registry_shard_t *qwistys_registry_shard(qwistys_registry_node_t *node) {
+    return &qwistys_registry[((uintptr_t)node >> 6) % QWISTYS_REGISTRY_SHARDS];
+}
+
+static inline void qwistys_registry_lock(qwistys_registry_shard_t *shard) {
+    while (__atomic_test_and_set(&shard->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&shard->lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static inline void qwistys_registry_unlock(qwistys_registry_shard_t *shard) {
+    __atomic_clear(&shard->lock, __ATOMIC_RELEASE);
+}
+
+static void qwistys_registry_add(qwistys_registry_node_t *node, qwistys_alloc_header_t *header, void *site) {
+    qwistys_registry_shard_t *shard = qwistys_registry_shard(node);
+    node->site = site;
+    node->header = header;
+    node->size = header->size;
+    node->prev = NULL;
+
+    qwistys_registry_lock(shard);
+    node->next = shard->head;
+    if (shard->head) {
+        shard->head->prev = node;
+    }
+    shard->head = node;
+    qwistys_registry_unlock(shard);
+}
+
+static void qwistys_registry_remove(qwistys_registry_node_t *node) {
+    qwistys_registry_shard_t *shard = qwistys_registry_shard(node);
+
+    qwistys_registry_lock(shard);
+    if (shard->scrubbing && shard->cursor == node) {
+        shard->cursor = node->next;
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        shard->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    }
+    qwistys_registry_unlock(shard);
+}
+
+API_IMPL void qwistys_alloc_registry_enable(int enable) {
+    __atomic_store_n(&qwistys_registry_enabled, enable, __ATOMIC_RELAXED);
+}
+
+// ================================================
+// Allocator
+// ================================================
+
+// Bytes in front of the header: registry node, offset word and padding (the
+// whole mapping in front of a mapped block)
+static inline size_t qwistys_alloc_prefix(qwistys_alloc_header_t *header) {
+    if (header->flags & QWISTYS_ALLOC_ALIGNED || (header->flags & QWISTYS_ALLOC_KIND_MASK) == QWISTYS_ALLOC_KIND_MMAP) {
+        return ((size_t *)header)[-1];
+    }
+    return (header->flags & QWISTYS_ALLOC_REGISTERED) ? sizeof(qwistys_registry_node_t) : 0;
+}
+
+static inline size_t qwistys_alloc_alignment(uint32_t flags) {
+    if (flags & QWISTYS_ALLOC_ALIGNED) {
+        return (size_t)1 << ((flags >> QWISTYS_ALLOC_ALIGN_SHIFT) & QWISTYS_ALLOC_ALIGN_MASK);
+    }
+    return QWISTYS_ALLOC_ALIGNMENT;
+}
+
+static inline qwistys_alloc_footer_t *qwistys_alloc_footer(qwistys_alloc_header_t *header) {
+    return (qwistys_alloc_footer_t *)((char *)header + sizeof(qwistys_alloc_header_t) + QWISTYS_ALLOC_ALIGN(header->size));
+}
+
+// Backing memory held by a block, header and footer included
+static inline size_t qwistys_alloc_footprint(qwistys_alloc_header_t *header, size_t prefix) {
+    switch (header->flags & QWISTYS_ALLOC_KIND_MASK) {
+    case QWISTYS_ALLOC_KIND_SLAB:
+        return qwistys_slab_class_size((header->flags >> QWISTYS_ALLOC_CLASS_SHIFT) & QWISTYS_ALLOC_CLASS_MASK);
+    case QWISTYS_ALLOC_KIND_MMAP:
+        return qwistys_mmap_data_length(prefix + QWISTYS_ALLOC_BLOCK_SIZE(header->size)) +
+               QWISTYS_ALLOC_GUARD_PAGES * qwistys_page();
+    default:
+        if (header->flags & QWISTYS_ALLOC_ALIGNED) {
+            // malloc was asked for the worst case padding, not the one it got
+            prefix = (header->flags & QWISTYS_ALLOC_REGISTERED ? sizeof(qwistys_registry_node_t) : 0) +
+                     sizeof(size_t) + qwistys_alloc_alignment(header->flags) - 1;
+        }
+        return prefix + QWISTYS_ALLOC_BLOCK_SIZE(header->size);
+    }
+}
+
+// Writes header and footer of a block, the callback may touch the canaries only
+static inline void qwistys_alloc_stamp(qwistys_alloc_header_t *header, uint32_t flags, size_t size,
+                                       user_canary_settings callback) {
+    header->canary = QWISTYS_ALLOC_HEADER_CANARY;
+    header->flags = flags;
+    header->size = size;
+    qwistys_alloc_footer_t *footer = qwistys_alloc_footer(header);
+    footer->canary = QWISTYS_ALLOC_CANARY;
+
+    if (callback) {
+        QWISTYS_DEBUG_MSG("Calling user callback on canary");
+        callback(header, footer);
+        header->flags = flags;
+        header->size = size;
+    }
+}
+
+// A wild write can hit the size and spare the canary, the size is checked
+// against the node before it is used to find the footer
+static inline int qwistys_alloc_intact(qwistys_registry_node_t *node) {
+    qwistys_alloc_header_t *header = node->header;
+    return header->canary == QWISTYS_ALLOC_HEADER_CANARY && header->size == node->size &&
+           qwistys_alloc_footer(header)->canary == QWISTYS_ALLOC_CANARY;
+}
+
+// Returns the header of a user pointer, halts if a canary is damaged
+static inline qwistys_alloc_header_t *qwistys_alloc_check(void *pointer) {
+    qwistys_alloc_header_t *header = (qwistys_alloc_header_t *)((char *)pointer - sizeof(qwistys_alloc_header_t));
+
+    QWISTYS_ASSERT(header->canary == QWISTYS_ALLOC_HEADER_CANARY);
+    if (header->canary != QWISTYS_ALLOC_HEADER_CANARY) {
+        qwistys_alloc_error = QWISTYS_ALLOC_ERROR_CORRUPTED_MEMORY;
+        QWISTYS_DEBUG_MSG("Corrupted memory detected at %p", pointer);
+        QWISTYS_HALT("Corrupted memory detected");
+    }
+
+    qwistys_alloc_footer_t *footer = qwistys_alloc_footer(header);
+    QWISTYS_ASSERT(footer->canary == QWISTYS_ALLOC_CANARY);
+    if (footer->canary != QWISTYS_ALLOC_CANARY) {
+        qwistys_alloc_error = QWISTYS_ALLOC_ERROR_CORRUPTED_MEMORY;
+        QWISTYS_DEBUG_MSG("Corrupted memory detected at %p", pointer);
+        QWISTYS_HALT("Corrupted memory detected");
+    }
+    return header;
+}
+
+static void* qwistys_alloc_block(size_t num_of_bytes, size_t alignment, user_canary_settings callback, void* site) {
     QWISTYS_TELEMETRY_START();
     QWISTYS_ASSERT(num_of_bytes != 0);
     QWISTYS_DEBUG_MSG("Trying to allocate %zu bytes", num_of_bytes);
 
-    size_t total_size = sizeof(qwistys_alloc_header_t) + QWISTYS_ALLOC_ALIGN(num_of_bytes) + sizeof(qwistys_alloc_footer_t);
-    char* block = (char*)malloc(total_size);
+    if (num_of_bytes > QWISTYS_ALLOC_MAX_SIZE) {
+        qwistys_alloc_error = QWISTYS_ALLOC_ERROR_INVALID_SIZE;
+        QWISTYS_DEBUG_MSG("Size %zu is above QWISTYS_ALLOC_MAX_SIZE", num_of_bytes);
+        QWISTYS_TELEMETRY_END();
+        return NULL;
+    }
+
+    qwistys_thread_cache_t* cache = qwistys_tcache_get();
+    uint32_t flags = 0;
+    size_t prefix = 0;
+    if (__atomic_load_n(&qwistys_registry_enabled, __ATOMIC_RELAXED)) {
+        flags |= QWISTYS_ALLOC_REGISTERED;
+        prefix += sizeof(qwistys_registry_node_t);
+    }
+    size_t slack = 0;
+    if (alignment > QWISTYS_ALLOC_ALIGNMENT) {
+        flags |= QWISTYS_ALLOC_ALIGNED | ((uint32_t)__builtin_ctzl(alignment) << QWISTYS_ALLOC_ALIGN_SHIFT);
+        prefix += sizeof(size_t);
+        slack = alignment - 1;
+    } else {
+        alignment = QWISTYS_ALLOC_ALIGNMENT;
+    }
+
+    size_t total_size = prefix + slack + QWISTYS_ALLOC_BLOCK_SIZE(num_of_bytes);
+    size_t mapped_length = 0;
+    char* block;
+    if (total_size <= QWISTYS_SLAB_MAX_BLOCK) {
+        size_t class_index = qwistys_slab_class_of(total_size);
+        flags |= QWISTYS_ALLOC_KIND_SLAB | ((uint32_t)class_index << QWISTYS_ALLOC_CLASS_SHIFT);
+        block = (char*)qwistys_tcache_alloc(cache, class_index);
+    } else if (total_size >= qwistys_alloc_get_mmap_threshold()) {
+        flags |= QWISTYS_ALLOC_KIND_MMAP;
+        if (!(flags & QWISTYS_ALLOC_ALIGNED)) {
+            prefix += sizeof(size_t); // Offset word
+        }
+        size_t offset = QWISTYS_ALLOC_ALIGN_TO(prefix + sizeof(qwistys_alloc_header_t), alignment) -
+                        sizeof(qwistys_alloc_header_t);
+        mapped_length = qwistys_mmap_data_length(offset + QWISTYS_ALLOC_BLOCK_SIZE(num_of_bytes));
+        block = (char*)qwistys_mmap_alloc(offset + QWISTYS_ALLOC_BLOCK_SIZE(num_of_bytes));
+    } else {
+        flags |= QWISTYS_ALLOC_KIND_HEAP;
+        block = (char*)malloc(total_size);
+    }
     if (block == NULL) {
         qwistys_alloc_error = QWISTYS_ALLOC_ERROR_OUT_OF_MEMORY;
         QWISTYS_DEBUG_MSG("Failed to allocate memory");
@@ -25,31 +924,55 @@ API_IMPL void* qwistys_alloc_internal(size_t num_of_bytes, user_canary_settings
         return NULL;
     }
 
-    qwistys_alloc_header_t* header = (qwistys_alloc_header_t*)block;
-    qwistys_alloc_footer_t* footer = (qwistys_alloc_footer_t*)(block + sizeof(qwistys_alloc_header_t) + QWISTYS_ALLOC_ALIGN(num_of_bytes));
-
-    if (!callback) {
-        header->canary = QWISTYS_ALLOC_CANARY;
-        header->size = num_of_bytes;
-        footer->canary = QWISTYS_ALLOC_CANARY;
+    uintptr_t user;
+    if (mapped_length) {
+        // Against the guard, the footer ends at most alignment - 1 bytes before it
+        user = ((uintptr_t)block + mapped_length - sizeof(qwistys_alloc_footer_t) - QWISTYS_ALLOC_ALIGN(num_of_bytes)) &
+               ~(uintptr_t)(alignment - 1);
     } else {
-        QWISTYS_DEBUG_MSG("Calling user callback on canary");
-        callback(header, footer);
+        user = QWISTYS_ALLOC_ALIGN_TO((uintptr_t)block + prefix + sizeof(qwistys_alloc_header_t), alignment);
     }
-
-    total_allocated += num_of_bytes;
-    current_usage += num_of_bytes;
-    if (current_usage > peak_usage) {
-        peak_usage = current_usage;
+    qwistys_alloc_header_t* header = (qwistys_alloc_header_t*)(user - sizeof(qwistys_alloc_header_t));
+    if (flags & QWISTYS_ALLOC_ALIGNED || mapped_length) {
+        ((size_t*)header)[-1] = (size_t)((char*)header - block);
     }
+    qwistys_alloc_stamp(header, flags, num_of_bytes, callback);
+    if (flags & QWISTYS_ALLOC_REGISTERED) {
+        qwistys_registry_add((qwistys_registry_node_t*)block, header, site);
+    }
+    qwistys_stats_alloc(cache, num_of_bytes, qwistys_alloc_footprint(header, (size_t)((char*)header - block)));
+    qwistys_profile_alloc(cache, header, num_of_bytes);
 
     QWISTYS_DEBUG_MSG("Successfully allocated %zu bytes", num_of_bytes);
     QWISTYS_TELEMETRY_END();
-    return block + sizeof(qwistys_alloc_header_t);
+    return (void*)user;
+}
+
+API_IMPL void* qwistys_alloc_internal(size_t num_of_bytes, user_canary_settings callback) {
+    return qwistys_alloc_block(num_of_bytes, 0, callback, __builtin_return_address(0));
 }
 
 API_IMPL void* qwistys_malloc(size_t num_of_bytes, user_canary_settings callback) {
-    return qwistys_alloc_internal(num_of_bytes, callback);
+    return qwistys_alloc_block(num_of_bytes, 0, callback, __builtin_return_address(0));
+}
+
+static inline int qwistys_alloc_valid_alignment(size_t alignment) {
+    // The log2 of the alignment has to fit QWISTYS_ALLOC_ALIGN_MASK, 64 KiB
+    // pages would overflow the compact header
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > qwistys_page() ||
+        alignment > QWISTYS_ALLOC_MAX_ALIGNMENT) {
+        qwistys_alloc_error = QWISTYS_ALLOC_ERROR_INVALID_SIZE;
+        QWISTYS_DEBUG_MSG("Alignment %zu is not a power of two up to the page size", alignment);
+        return 0;
+    }
+    return 1;
+}
+
+API_IMPL void* qwistys_aligned_alloc(size_t alignment, size_t num_of_bytes, user_canary_settings callback) {
+    if (!qwistys_alloc_valid_alignment(alignment)) {
+        return NULL;
+    }
+    return qwistys_alloc_block(num_of_bytes, alignment, callback, __builtin_return_address(0));
 }
 
 API_IMPL void qwistys_free(void* pointer) {
@@ -60,26 +983,42 @@ API_IMPL void qwistys_free(void* pointer) {
         return;
     }
 
-    char* block = (char*)pointer - sizeof(qwistys_alloc_header_t);
-    qwistys_alloc_header_t* header = (qwistys_alloc_header_t*)block;
-    qwistys_alloc_footer_t* footer = (qwistys_alloc_footer_t*)(block + sizeof(qwistys_alloc_header_t) + QWISTYS_ALLOC_ALIGN(header->size));
+    qwistys_alloc_header_t* header = qwistys_alloc_check(pointer);
+    size_t prefix = qwistys_alloc_prefix(header);
+    char* block = (char*)header - prefix;
+    uint32_t flags = header->flags;
 
-    QWISTYS_ASSERT(header->canary == QWISTYS_ALLOC_CANARY && footer->canary == QWISTYS_ALLOC_CANARY);
+    qwistys_thread_cache_t* cache = qwistys_tcache_get();
+    qwistys_stats_free(cache, header->size, qwistys_alloc_footprint(header, prefix));
 
-    if (header->canary != QWISTYS_ALLOC_CANARY || footer->canary != QWISTYS_ALLOC_CANARY) {
-        qwistys_alloc_error = QWISTYS_ALLOC_ERROR_CORRUPTED_MEMORY;
-        QWISTYS_DEBUG_MSG("Corrupted memory detected at %p", pointer);
-        QWISTYS_HALT("Corrupted memory detected");
+    if (flags & QWISTYS_ALLOC_SAMPLED) {
+        qwistys_profile_free(pointer);
+    }
+    if (flags & QWISTYS_ALLOC_REGISTERED) {
+        qwistys_registry_remove((qwistys_registry_node_t*)block);
     }
-
-    total_freed += header->size;
-    current_usage -= header->size;
 
     QWISTYS_DEBUG_MSG("Successfully freed %zu bytes at %p", header->size, pointer);
-    free(block);
+    // Poison the canary so a double free is caught as corruption
+    header->canary = 0;
+    switch (flags & QWISTYS_ALLOC_KIND_MASK) {
+    case QWISTYS_ALLOC_KIND_SLAB:
+        qwistys_tcache_free(cache, block, (flags >> QWISTYS_ALLOC_CLASS_SHIFT) & QWISTYS_ALLOC_CLASS_MASK);
+        break;
+    case QWISTYS_ALLOC_KIND_MMAP:
+        qwistys_mmap_free(block, prefix + QWISTYS_ALLOC_BLOCK_SIZE(header->size));
+        break;
+    default:
+        free(block);
+        break;
+    }
     QWISTYS_TELEMETRY_END();
 }
 
+API_IMPL void qwistys_aligned_free(void* pointer) {
+    qwistys_free(pointer);
+}
+
 API_IMPL void* qwistys_calloc(size_t num, size_t size, user_canary_settings callback) {
     QWISTYS_TELEMETRY_START();
     
@@ -91,7 +1030,7 @@ API_IMPL void* qwistys_calloc(size_t num, size_t size, user_canary_settings call
         return NULL;
     }
 
-    void* ptr = qwistys_alloc_internal(total_size, callback);
+    void* ptr = qwistys_alloc_block(total_size, 0, callback, __builtin_return_address(0));
     if (ptr) {
         memset(ptr, 0, total_size);
     }
@@ -100,12 +1039,14 @@ API_IMPL void* qwistys_calloc(size_t num, size_t size, user_canary_settings call
     return ptr;
 }
 
-API_IMPL void* qwistys_realloc(void* ptr, size_t new_size, user_canary_settings callback) {
+// alignment 0 keeps the alignment the block was allocated with
+static void* qwistys_realloc_block(void* ptr, size_t new_size, size_t alignment, user_canary_settings callback,
+                                   void* site) {
     QWISTYS_TELEMETRY_START();
     
     if (!ptr) {
         QWISTYS_TELEMETRY_END();
-        return qwistys_malloc(new_size, callback);
+        return qwistys_alloc_block(new_size, alignment, callback, site);
     }
 
     if (new_size == 0) {
@@ -114,22 +1055,96 @@ API_IMPL void* qwistys_realloc(void* ptr, size_t new_size, user_canary_settings
         return NULL;
     }
 
-    qwistys_alloc_header_t* header = (qwistys_alloc_header_t*)((char*)ptr - sizeof(qwistys_alloc_header_t));
-    QWISTYS_ASSERT(header->canary == QWISTYS_ALLOC_CANARY);
+    if (new_size > QWISTYS_ALLOC_MAX_SIZE) {
+        qwistys_alloc_error = QWISTYS_ALLOC_ERROR_INVALID_SIZE;
+        QWISTYS_DEBUG_MSG("Size %zu is above QWISTYS_ALLOC_MAX_SIZE", new_size);
+        QWISTYS_TELEMETRY_END();
+        return NULL;
+    }
 
-    if (header->canary != QWISTYS_ALLOC_CANARY) {
-        qwistys_alloc_error = QWISTYS_ALLOC_ERROR_CORRUPTED_MEMORY;
-        QWISTYS_DEBUG_MSG("Corrupted memory detected at %p", ptr);
-        QWISTYS_HALT("Corrupted memory detected");
+    qwistys_alloc_header_t* header = qwistys_alloc_check(ptr);
+    size_t old_size = header->size;
+    uint32_t flags = header->flags;
+    size_t prefix = qwistys_alloc_prefix(header);
+    char* block = (char*)header - prefix;
+    size_t old_total = prefix + QWISTYS_ALLOC_BLOCK_SIZE(old_size);
+    size_t old_footprint = qwistys_alloc_footprint(header, prefix);
+    size_t new_total = prefix + QWISTYS_ALLOC_BLOCK_SIZE(new_size);
+    char* resized = NULL;
+    if (!alignment) {
+        alignment = qwistys_alloc_alignment(flags);
+    }
+    // A block allocated with a smaller alignment has to move, even if it
+    // happens to sit on the asked one, later resizes keep the recorded one
+    int movable_only = alignment > qwistys_alloc_alignment(flags);
+
+    // The node leaves the registry while the block changes shape and place
+    if (flags & QWISTYS_ALLOC_REGISTERED) {
+        site = ((qwistys_registry_node_t*)block)->site;
+        qwistys_registry_remove((qwistys_registry_node_t*)block);
+    }
+
+    if (movable_only) {
+        // Straight to the copy
+    } else if ((flags & QWISTYS_ALLOC_KIND_MASK) == QWISTYS_ALLOC_KIND_SLAB) {
+        // Stay in the slot as long as it fits and at least half of it is used
+        size_t slot_size = qwistys_slab_class_size((flags >> QWISTYS_ALLOC_CLASS_SHIFT) & QWISTYS_ALLOC_CLASS_MASK);
+        if (new_total <= slot_size && new_total * 2 > slot_size) {
+            resized = block;
+        }
+    } else if (QWISTYS_ALLOC_ALIGN(new_size) == QWISTYS_ALLOC_ALIGN(old_size)) {
+        // The alignment padding already has room, only the footer moves
+        resized = block;
+    } else if ((flags & QWISTYS_ALLOC_KIND_MASK) == QWISTYS_ALLOC_KIND_MMAP) {
+        if (new_total > QWISTYS_SLAB_MAX_BLOCK) {
+            resized = (char*)qwistys_mmap_resize(block, old_total, new_total);
+        }
+    } else if (new_total > QWISTYS_SLAB_MAX_BLOCK && new_total < qwistys_alloc_get_mmap_threshold() &&
+               !(flags & QWISTYS_ALLOC_ALIGNED)) {
+        // libc grows or shrinks in place when it can (mremap for its mmapped chunks),
+        // it only keeps 16 byte alignment so over-aligned blocks are copied
+        resized = (char*)realloc(block, new_total);
+        if (!resized) {
+            if (flags & QWISTYS_ALLOC_REGISTERED) {
+                qwistys_registry_add((qwistys_registry_node_t*)block, header, site);
+            }
+            qwistys_alloc_error = QWISTYS_ALLOC_ERROR_OUT_OF_MEMORY;
+            QWISTYS_DEBUG_MSG("Failed to reallocate memory");
+            QWISTYS_TELEMETRY_END();
+            return NULL;
+        }
+    }
+
+    if (resized) {
+        // Accounted like a free and a new allocation, the profiler may sample it again
+        if (flags & QWISTYS_ALLOC_SAMPLED) {
+            qwistys_profile_free(ptr);
+            flags &= ~QWISTYS_ALLOC_SAMPLED;
+        }
+        qwistys_alloc_header_t* resized_header = (qwistys_alloc_header_t*)(resized + prefix);
+        qwistys_alloc_stamp(resized_header, flags, new_size, callback);
+        if (flags & QWISTYS_ALLOC_REGISTERED) {
+            qwistys_registry_add((qwistys_registry_node_t*)resized, resized_header, site);
+        }
+        qwistys_thread_cache_t* cache = qwistys_tcache_get();
+        qwistys_stats_free(cache, old_size, old_footprint);
+        qwistys_stats_alloc(cache, new_size, qwistys_alloc_footprint(resized_header, prefix));
+        qwistys_profile_alloc(cache, resized_header, new_size);
+        QWISTYS_DEBUG_MSG("Resized %zu -> %zu bytes without copy", old_size, new_size);
+        QWISTYS_TELEMETRY_END();
+        return (char*)resized_header + sizeof(qwistys_alloc_header_t);
     }
 
-    void* new_ptr = qwistys_malloc(new_size, callback);
+    if (flags & QWISTYS_ALLOC_REGISTERED) {
+        qwistys_registry_add((qwistys_registry_node_t*)block, header, site);
+    }
+    void* new_ptr = qwistys_alloc_block(new_size, alignment, callback, site);
     if (!new_ptr) {
         QWISTYS_TELEMETRY_END();
         return NULL;
     }
 
-    size_t copy_size = (new_size < header->size) ? new_size : header->size;
+    size_t copy_size = (new_size < old_size) ? new_size : old_size;
     memcpy(new_ptr, ptr, copy_size);
     qwistys_free(ptr);
 
@@ -137,6 +1152,17 @@ API_IMPL void* qwistys_realloc(void* ptr, size_t new_size, user_canary_settings
     return new_ptr;
 }
 
+API_IMPL void* qwistys_realloc(void* ptr, size_t new_size, user_canary_settings callback) {
+    return qwistys_realloc_block(ptr, new_size, 0, callback, __builtin_return_address(0));
+}
+
+API_IMPL void* qwistys_aligned_realloc(void* ptr, size_t alignment, size_t new_size, user_canary_settings callback) {
+    if (!qwistys_alloc_valid_alignment(alignment)) {
+        return NULL;
+    }
+    return qwistys_realloc_block(ptr, new_size, alignment, callback, __builtin_return_address(0));
+}
+
 API_IMPL size_t qwistys_get_allocated_size(void* ptr) {
     QWISTYS_TELEMETRY_START();
     
@@ -148,9 +1174,9 @@ API_IMPL size_t qwistys_get_allocated_size(void* ptr) {
     }
 
     qwistys_alloc_header_t* header = (qwistys_alloc_header_t*)((char*)ptr - sizeof(qwistys_alloc_header_t));
-    QWISTYS_ASSERT(header->canary == QWISTYS_ALLOC_CANARY);
+    QWISTYS_ASSERT(header->canary == QWISTYS_ALLOC_HEADER_CANARY);
 
-    if (header->canary != QWISTYS_ALLOC_CANARY) {
+    if (header->canary != QWISTYS_ALLOC_HEADER_CANARY) {
         qwistys_alloc_error = QWISTYS_ALLOC_ERROR_CORRUPTED_MEMORY;
         QWISTYS_DEBUG_MSG("Corrupted memory detected at %p", ptr);
         QWISTYS_HALT("Corrupted memory detected");
@@ -160,14 +1186,260 @@ API_IMPL size_t qwistys_get_allocated_size(void* ptr) {
     return header->size;
 }
 
+API_IMPL void qwistys_alloc_get_stats(qwistys_alloc_stats_t* stats) {
+    QWISTYS_ASSERT(stats != NULL);
+    QWISTYS_TELEMETRY_START();
+
+    pthread_mutex_lock(&qwistys_tcache_lock);
+    size_t allocated = qwistys_retired_allocated;
+    size_t freed = qwistys_retired_freed;
+    size_t footprint = qwistys_retired_footprint;
+    size_t peak = __atomic_load_n(&qwistys_peak_usage, __ATOMIC_RELAXED);
+    for (qwistys_thread_cache_t* cache = qwistys_tcache_list; cache; cache = cache->next) {
+        allocated += __atomic_load_n(&cache->allocated, __ATOMIC_RELAXED);
+        freed += __atomic_load_n(&cache->freed, __ATOMIC_RELAXED);
+        footprint += __atomic_load_n(&cache->footprint, __ATOMIC_RELAXED);
+        peak = QWISTYS_MAX(peak, __atomic_load_n(&cache->peak, __ATOMIC_RELAXED));
+    }
+    pthread_mutex_unlock(&qwistys_tcache_lock);
+
+    // A block freed by another thread than the one that allocated it only
+    // balances out in the sum, so the per thread numbers are never reported
+    stats->total_allocated = allocated;
+    stats->total_freed = freed;
+    stats->current_usage = allocated - freed;
+    stats->peak_usage = QWISTYS_MAX(peak, stats->current_usage);
+    stats->current_footprint = footprint;
+
+    QWISTYS_TELEMETRY_END();
+}
+
 API_IMPL void qwistys_print_memory_stats(void) {
     QWISTYS_TELEMETRY_START();
     
+    qwistys_alloc_stats_t stats;
+    qwistys_alloc_get_stats(&stats);
     QWISTYS_DEBUG_MSG("Memory Statistics:");
-    QWISTYS_DEBUG_MSG("Total Allocated: %zu bytes", total_allocated);
-    QWISTYS_DEBUG_MSG("Total Freed: %zu bytes", total_freed);
-    QWISTYS_DEBUG_MSG("Current Usage: %zu bytes", current_usage);
-    QWISTYS_DEBUG_MSG("Peak Usage: %zu bytes", peak_usage);
+    QWISTYS_DEBUG_MSG("Total Allocated: %zu bytes", stats.total_allocated);
+    QWISTYS_DEBUG_MSG("Total Freed: %zu bytes", stats.total_freed);
+    QWISTYS_DEBUG_MSG("Current Usage: %zu bytes", stats.current_usage);
+    QWISTYS_DEBUG_MSG("Current Footprint: %zu bytes", stats.current_footprint);
+    QWISTYS_DEBUG_MSG("Peak Usage: %zu bytes", stats.peak_usage);
     
     QWISTYS_TELEMETRY_END();
 }
+
+// ================================================
+// Arena
+// ================================================
+
+struct qwistys_arena_block_t {
+    qwistys_arena_block_t *next;
+    size_t capacity;
+};
+
+#define QWISTYS_ARENA_BLOCK_HEADER QWISTYS_ALLOC_ALIGN(sizeof(qwistys_arena_block_t))
+
+static inline char* qwistys_arena_block_data(qwistys_arena_block_t* block) {
+    return (char*)block + QWISTYS_ARENA_BLOCK_HEADER;
+}
+
+API_IMPL void qwistys_arena_init(qwistys_arena_t* arena, size_t block_size) {
+    QWISTYS_ASSERT(arena != NULL);
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+    arena->block_size = block_size ? block_size : QWISTYS_ARENA_BLOCK_SIZE;
+}
+
+API_IMPL void* qwistys_arena_alloc(qwistys_arena_t* arena, size_t size) {
+    QWISTYS_ASSERT(arena != NULL);
+    QWISTYS_ASSERT(size != 0);
+    QWISTYS_TELEMETRY_START();
+
+    size = QWISTYS_ALLOC_ALIGN(size);
+    qwistys_arena_block_t* block = arena->current;
+    if (block && block->capacity - arena->used >= size) {
+        void* ptr = qwistys_arena_block_data(block) + arena->used;
+        arena->used += size;
+        QWISTYS_TELEMETRY_END();
+        return ptr;
+    }
+
+    // Reuse the spare block after the current one if it is big enough,
+    // otherwise put a new one in front of the spares
+    qwistys_arena_block_t* next = block ? block->next : arena->first;
+    if (!next || next->capacity < size) {
+        size_t capacity = QWISTYS_MAX(arena->block_size, size);
+        qwistys_arena_block_t* fresh = (qwistys_arena_block_t*)qwistys_malloc(QWISTYS_ARENA_BLOCK_HEADER + capacity, NULL);
+        if (!fresh) {
+            QWISTYS_DEBUG_MSG("Failed to grow arena by %zu bytes", capacity);
+            QWISTYS_TELEMETRY_END();
+            return NULL;
+        }
+        fresh->capacity = capacity;
+        fresh->next = next;
+        if (block) {
+            block->next = fresh;
+        } else {
+            arena->first = fresh;
+        }
+        next = fresh;
+    }
+
+    arena->current = next;
+    arena->used = size;
+    QWISTYS_TELEMETRY_END();
+    return qwistys_arena_block_data(next);
+}
+
+API_IMPL qwistys_arena_mark_t qwistys_arena_mark(qwistys_arena_t* arena) {
+    QWISTYS_ASSERT(arena != NULL);
+    qwistys_arena_mark_t mark = {arena->current, arena->used};
+    return mark;
+}
+
+API_IMPL void qwistys_arena_rewind(qwistys_arena_t* arena, qwistys_arena_mark_t mark) {
+    QWISTYS_ASSERT(arena != NULL);
+    arena->current = mark.block;
+    arena->used = mark.used;
+}
+
+API_IMPL void qwistys_arena_reset(qwistys_arena_t* arena) {
+    QWISTYS_ASSERT(arena != NULL);
+    arena->current = NULL;
+    arena->used = 0;
+}
+
+API_IMPL void qwistys_arena_free(qwistys_arena_t* arena) {
+    QWISTYS_ASSERT(arena != NULL);
+    QWISTYS_TELEMETRY_START();
+
+    qwistys_arena_block_t* block = arena->first;
+    while (block) {
+        qwistys_arena_block_t* next = block->next;
+        qwistys_free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+
+    QWISTYS_DEBUG_MSG("Arena freed successfully");
+    QWISTYS_TELEMETRY_END();
+}
+
+// ================================================
+// Allocator interface
+// ================================================
+
+static void* qwistys_default_alloc(void* context, size_t size) {
+    (void)context;
+    return qwistys_malloc(size, NULL);
+}
+
+static void* qwistys_default_realloc(void* context, void* pointer, size_t old_size, size_t new_size) {
+    (void)context;
+    (void)old_size;
+    return qwistys_realloc(pointer, new_size, NULL);
+}
+
+static void qwistys_default_free(void* context, void* pointer) {
+    (void)context;
+    qwistys_free(pointer);
+}
+
+static const qwistys_allocator_t qwistys_default_allocator = {
+    qwistys_default_alloc, qwistys_default_realloc, qwistys_default_free, NULL};
+
+API_IMPL const qwistys_allocator_t* qwistys_allocator_default(void) {
+    return &qwistys_default_allocator;
+}
+
+static void* qwistys_arena_allocator_alloc(void* context, size_t size) {
+    return qwistys_arena_alloc((qwistys_arena_t*)context, size);
+}
+
+static void* qwistys_arena_allocator_realloc(void* context, void* pointer, size_t old_size, size_t new_size) {
+    qwistys_arena_t* arena = (qwistys_arena_t*)context;
+    if (!pointer) {
+        return qwistys_arena_alloc(arena, new_size);
+    }
+    if (QWISTYS_ALLOC_ALIGN(new_size) <= QWISTYS_ALLOC_ALIGN(old_size)) {
+        return pointer;
+    }
+    // The last allocation of the current block grows in place
+    qwistys_arena_block_t* block = arena->current;
+    char* end = (char*)pointer + QWISTYS_ALLOC_ALIGN(old_size);
+    if (block && end == qwistys_arena_block_data(block) + arena->used &&
+        block->capacity - arena->used >= QWISTYS_ALLOC_ALIGN(new_size) - QWISTYS_ALLOC_ALIGN(old_size)) {
+        arena->used += QWISTYS_ALLOC_ALIGN(new_size) - QWISTYS_ALLOC_ALIGN(old_size);
+        return pointer;
+    }
+    void* moved = qwistys_arena_alloc(arena, new_size);
+    if (moved) {
+        memcpy(moved, pointer, old_size);
+    }
+    return moved;
+}
+
+static void qwistys_arena_allocator_free(void* context, void* pointer) {
+    (void)context;
+    (void)pointer;
+}
+
+API_IMPL void qwistys_arena_allocator(qwistys_arena_t* arena, qwistys_allocator_t* allocator) {
+    QWISTYS_ASSERT(arena != NULL);
+    QWISTYS_ASSERT(allocator != NULL);
+    allocator->alloc = qwistys_arena_allocator_alloc;
+    allocator->realloc = qwistys_arena_allocator_realloc;
+    allocator->free = qwistys_arena_allocator_free;
+    allocator->context = arena;
+}
+
+// ================================================
+// Scrubber
+// ================================================
+
+API_IMPL int qwistys_alloc_scrub(size_t max_blocks, qwistys_alloc_corruption_t* report) {
+    QWISTYS_TELEMETRY_START();
+
+    int corrupted = 0;
+    size_t checked = 0;
+    size_t shards_done = 0;
+
+    pthread_mutex_lock(&qwistys_scrub_lock);
+    while (checked < max_blocks && shards_done < QWISTYS_REGISTRY_SHARDS && !corrupted) {
+        qwistys_registry_shard_t* shard = &qwistys_registry[qwistys_scrub_shard];
+
+        qwistys_registry_lock(shard);
+        qwistys_registry_node_t* node = shard->scrubbing ? shard->cursor : shard->head;
+        shard->scrubbing = 1;
+        for (; node && checked < max_blocks; node = node->next, checked++) {
+            if (!qwistys_alloc_intact(node)) {
+                corrupted = 1;
+                qwistys_alloc_error = QWISTYS_ALLOC_ERROR_CORRUPTED_MEMORY;
+                if (report) {
+                    report->pointer = (char*)node->header + sizeof(qwistys_alloc_header_t);
+                    report->size = node->size;
+                    report->site = node->site;
+                }
+                QWISTYS_ERROR_MSG("Corrupted block %p allocated from %p",
+                                  (void*)((char*)node->header + sizeof(qwistys_alloc_header_t)), node->site);
+                node = node->next;
+                break;
+            }
+        }
+        shard->cursor = node;
+        if (!node) {
+            shard->scrubbing = 0;
+            qwistys_scrub_shard = (qwistys_scrub_shard + 1) % QWISTYS_REGISTRY_SHARDS;
+            shards_done++;
+        }
+        qwistys_registry_unlock(shard);
+    }
+    pthread_mutex_unlock(&qwistys_scrub_lock);
+
+    QWISTYS_TELEMETRY_END();
+    return corrupted;
+}
@@ -22,16 +22,71 @@ typedef enum {
 // Global error variable
 static qwistys_alloc_error_t qwistys_alloc_error;
 
-// Alignment
+// Compact mode (define QWISTYS_ALLOC_COMPACT for the library and its users):
+// 8 byte header and 4 byte footer instead of 16 and 8, blocks are 8 byte
+// aligned and smaller than 4 GiB. qwistys_aligned_alloc takes alignments up
+// to the page size, capped at QWISTYS_ALLOC_MAX_ALIGNMENT.
+#ifdef QWISTYS_ALLOC_COMPACT
+#define QWISTYS_ALLOC_ALIGNMENT 8
+#define QWISTYS_ALLOC_MAX_ALIGNMENT ((size_t)1 << 15) // 4 bit log2 in the header flags
+#else
 #define QWISTYS_ALLOC_ALIGNMENT 16
+#define QWISTYS_ALLOC_MAX_ALIGNMENT (SIZE_MAX / 2 + 1)
+#endif
+
+// Alignment
 #define QWISTYS_ALLOC_ALIGN(size) (((size) + (QWISTYS_ALLOC_ALIGNMENT - 1)) & ~(QWISTYS_ALLOC_ALIGNMENT - 1))
+#define QWISTYS_ALLOC_ALIGN_TO(size, alignment) (((size) + ((alignment) - 1)) & ~((alignment) - 1))
 
 // Canary value
 #define QWISTYS_ALLOC_CANARY 0xFFFFFACAUL
 
+// Slab front-end: blocks up to QWISTYS_SLAB_MAX_BLOCK bytes (header and footer
+// included) are carved out of QWISTYS_SLAB_CHUNK_SIZE chunks and recycled
+// through per size-class free lists, bigger blocks go straight to libc.
+#ifndef QWISTYS_SLAB_MAX_BLOCK
+#define QWISTYS_SLAB_MAX_BLOCK 4096
+#endif
+#ifndef QWISTYS_SLAB_CHUNK_SIZE
+#define QWISTYS_SLAB_CHUNK_SIZE (256 * 1024)
+#endif
+
+// Blocks of at least this many bytes (header and footer included) are mapped
+// directly and followed by QWISTYS_ALLOC_GUARD_PAGES inaccessible pages,
+// see qwistys_alloc_set_mmap_threshold
+#ifndef QWISTYS_ALLOC_MMAP_THRESHOLD
+#define QWISTYS_ALLOC_MMAP_THRESHOLD (256 * 1024)
+#endif
+#ifndef QWISTYS_ALLOC_GUARD_PAGES
+#define QWISTYS_ALLOC_GUARD_PAGES 1
+#endif
+
+// Heap profiler defaults
+#ifndef QWISTYS_HEAP_PROFILE_PERIOD
+#define QWISTYS_HEAP_PROFILE_PERIOD (512 * 1024)
+#endif
+#ifndef QWISTYS_HEAP_PROFILE_DEPTH
+#define QWISTYS_HEAP_PROFILE_DEPTH 32
+#endif
+
 // Memory header and footer
+#ifdef QWISTYS_ALLOC_COMPACT
 typedef struct {
-    uintptr_t canary;
+    uint16_t canary;
+    uint16_t flags; // Owned by the allocator (block kind, size class)
+    uint32_t size;
+} qwistys_alloc_header_t;
+
+typedef struct {
+    uint32_t canary;
+} qwistys_alloc_footer_t;
+
+#define QWISTYS_ALLOC_HEADER_CANARY ((uint16_t)QWISTYS_ALLOC_CANARY)
+#define QWISTYS_ALLOC_MAX_SIZE ((size_t)UINT32_MAX - 2 * QWISTYS_ALLOC_ALIGNMENT)
+#else
+typedef struct {
+    uint32_t canary;
+    uint32_t flags; // Owned by the allocator (block kind, size class)
     size_t size;
 } qwistys_alloc_header_t;
 
@@ -39,7 +94,58 @@ typedef struct {
     uintptr_t canary;
 } qwistys_alloc_footer_t;
 
+#define QWISTYS_ALLOC_HEADER_CANARY ((uint32_t)QWISTYS_ALLOC_CANARY)
+#define QWISTYS_ALLOC_MAX_SIZE (SIZE_MAX / 2)
+#endif
+
+// Allocator statistics, merged from all threads
+typedef struct {
+    size_t total_allocated;
+    size_t total_freed;
+    size_t current_usage;
+    size_t peak_usage; // Tracked within QWISTYS_ALLOC_STATS_BATCH bytes per thread
+    size_t current_footprint; // Memory held by live blocks: headers, padding, slots, pages
+} qwistys_alloc_stats_t;
+
+// Arena: bump allocation through big blocks, released all at once
+#ifndef QWISTYS_ARENA_BLOCK_SIZE
+#define QWISTYS_ARENA_BLOCK_SIZE (64 * 1024)
+#endif
+
+typedef struct qwistys_arena_block_t qwistys_arena_block_t;
+
+typedef struct {
+    qwistys_arena_block_t *first;   // Oldest block
+    qwistys_arena_block_t *current; // Block being bumped, the ones after it are spare
+    size_t used;                    // Bytes used in current
+    size_t block_size;              // Default size of a new block
+} qwistys_arena_t;
+
+typedef struct {
+    qwistys_arena_block_t *block;
+    size_t used;
+} qwistys_arena_mark_t;
+
+// Memory source handed to containers (flexa, stack, avl tree)
+// @note old_size is the size the block was allocated or last resized with,
+// sources that do not keep sizes (arenas, pools) need it to copy.
+typedef struct {
+    void *(*alloc)(void *context, size_t size);
+    void *(*realloc)(void *context, void *pointer, size_t old_size, size_t new_size);
+    void (*free)(void *context, void *pointer);
+    void *context;
+} qwistys_allocator_t;
+
+// First damaged block found by qwistys_alloc_scrub
+typedef struct {
+    void *pointer; // User pointer of the block
+    size_t size;   // Size the block was allocated or last resized with
+    void *site;    // Return address of the call that allocated the block
+} qwistys_alloc_corruption_t;
+
 // Callback type for custom canary settings
+// @note called after the allocator filled the header, size and flags are
+// restored once it returns.
 typedef void (*user_canary_settings)(qwistys_alloc_header_t *, qwistys_alloc_footer_t *);
 
 // Function prototypes 
@@ -48,8 +154,114 @@ API_IMPL void qwistys_free(void* pointer);
 API_IMPL void* qwistys_calloc(size_t num, size_t size, user_canary_settings callback);
 API_IMPL void* qwistys_realloc(void* ptr, size_t new_size, user_canary_settings callback);
 API_IMPL size_t qwistys_get_allocated_size(void* ptr);
+
+/**
+ * @brief Allocate memory whose address is a multiple of alignment
+ * @param alignment power of two, up to the page size and QWISTYS_ALLOC_MAX_ALIGNMENT
+ * @note canaries and stats work as for qwistys_malloc, qwistys_realloc and
+ * qwistys_free accept the block too and keep its alignment
+ * @return pointer to memory or NULL on fail
+ */
+API_IMPL void* qwistys_aligned_alloc(size_t alignment, size_t num_of_bytes, user_canary_settings callback);
+
+/**
+ * @brief Resize a block, the result is aligned to alignment
+ * @note the block moves if it does not have the new alignment already
+ */
+API_IMPL void* qwistys_aligned_realloc(void* ptr, size_t alignment, size_t new_size, user_canary_settings callback);
+API_IMPL void qwistys_aligned_free(void* ptr);
+API_IMPL void qwistys_alloc_set_mmap_threshold(size_t num_of_bytes);
+API_IMPL size_t qwistys_alloc_get_mmap_threshold(void);
+API_IMPL void qwistys_alloc_get_stats(qwistys_alloc_stats_t* stats);
 API_IMPL void qwistys_print_memory_stats(void);
 
+/**
+ * @brief Start sampling allocations, drops what an earlier run collected
+ * @param sample_period average number of allocated bytes between two samples,
+ * 0 for QWISTYS_HEAP_PROFILE_PERIOD
+ * @return 0 on success -1 on fail
+ * @note works in release builds, a not sampled allocation costs a subtraction
+ */
+API_IMPL int qwistys_heap_profile_start(size_t sample_period);
+
+/**
+ * @brief Stop sampling and drop the collected sites
+ */
+API_IMPL void qwistys_heap_profile_stop(void);
+
+/**
+ * @brief Write live and total sampled bytes per allocation stack to path
+ * @note gperftools heap profile format: pprof --inuse_space / --alloc_space,
+ * compare two dumps (pprof --base) for the allocation rate
+ * @return 0 on success -1 on fail
+ */
+API_IMPL int qwistys_heap_profile_dump(const char* path);
+
+/**
+ * @brief Start or stop registering blocks allocated from now on
+ * @note a registered block carries a 48 byte node (40 in compact mode), blocks allocated while
+ * the registry is off are never scrubbed
+ */
+API_IMPL void qwistys_alloc_registry_enable(int enable);
+
+/**
+ * @brief Check the canaries of up to max_blocks registered blocks
+ * @note every call resumes where the previous one stopped and walks at most
+ * the whole registry once, so it can run in bounded slices from any thread
+ * @param report filled with the first damaged block found, may be NULL
+ * @return 1 if a damaged block was found 0 otherwise
+ */
+API_IMPL int qwistys_alloc_scrub(size_t max_blocks, qwistys_alloc_corruption_t* report);
+
+/**
+ * @brief Initialize an arena, no memory is taken until the first allocation
+ * @param block_size size of each block, 0 for QWISTYS_ARENA_BLOCK_SIZE
+ * @note an arena is not thread safe, give each thread its own
+ */
+API_IMPL void qwistys_arena_init(qwistys_arena_t* arena, size_t block_size);
+
+/**
+ * @brief Bump allocate QWISTYS_ALLOC_ALIGNMENT aligned memory from the arena
+ * @note the memory must not be passed to qwistys_free, it lives until the
+ * arena is rewound, reset or freed
+ * @return pointer to memory or NULL on fail
+ */
+API_IMPL void* qwistys_arena_alloc(qwistys_arena_t* arena, size_t size);
+
+/**
+ * @brief Remember the current position of the arena
+ */
+API_IMPL qwistys_arena_mark_t qwistys_arena_mark(qwistys_arena_t* arena);
+
+/**
+ * @brief Release everything allocated since the mark was taken
+ * @note blocks stay with the arena and are reused by later allocations
+ */
+API_IMPL void qwistys_arena_rewind(qwistys_arena_t* arena, qwistys_arena_mark_t mark);
+
+/**
+ * @brief Release everything allocated from the arena in O(1), keeps the blocks
+ */
+API_IMPL void qwistys_arena_reset(qwistys_arena_t* arena);
+
+/**
+ * @brief Give all blocks of the arena back
+ */
+API_IMPL void qwistys_arena_free(qwistys_arena_t* arena);
+
+/**
+ * @brief The allocator containers use when they are given none
+ * @return qwistys_malloc, qwistys_realloc and qwistys_free behind the interface
+ */
+API_IMPL const qwistys_allocator_t* qwistys_allocator_default(void);
+
+/**
+ * @brief Describe an arena as an allocator
+ * @note free is a no-op and realloc copies when growing, memory comes back
+ * with qwistys_arena_reset/free. The arena must outlive the allocator users.
+ */
+API_IMPL void qwistys_arena_allocator(qwistys_arena_t* arena, qwistys_allocator_t* allocator);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,8 +8,17 @@ void avl_tree_init(avl_tree_t *tree, qwistys_mutex_t *mutex,
                    qwistys_mutex_destroy_fn destroy_fn,
                    qwistys_mutex_lock_fn lock_fn,
                    qwistys_mutex_unlock_fn unlock_fn) {
+    avl_tree_init_ex(tree, NULL, mutex, init_fn, destroy_fn, lock_fn, unlock_fn);
+}
+
+void avl_tree_init_ex(avl_tree_t *tree, const qwistys_allocator_t *allocator, qwistys_mutex_t *mutex,
+                      qwistys_mutex_init_fn init_fn,
+                      qwistys_mutex_destroy_fn destroy_fn,
+                      qwistys_mutex_lock_fn lock_fn,
+                      qwistys_mutex_unlock_fn unlock_fn) {
     QWISTYS_TELEMETRY_START();
     tree->root = NULL;
+    tree->allocator = allocator ? allocator : qwistys_allocator_default();
     tree->mutex = mutex;
     tree->mutex_init = init_fn;
     tree->mutex_destroy = destroy_fn;
@@ -22,7 +31,7 @@ void avl_tree_init(avl_tree_t *tree, qwistys_mutex_t *mutex,
 avlt_node_t *avl_tree_insert(avl_tree_t *tree, void *user_data, size_t data_length, int (*cmp)(void *, void *)) {
     QWISTYS_TELEMETRY_START();
     tree->mutex_lock(tree->mutex);
-    tree->root = avlt_insert(tree->root, user_data, data_length, cmp);
+    tree->root = avlt_insert_ex(tree->root, user_data, data_length, cmp, tree->allocator);
     tree->mutex_unlock(tree->mutex);
     QWISTYS_TELEMETRY_END();
     return tree->root;
@@ -30,14 +39,14 @@ avlt_node_t *avl_tree_insert(avl_tree_t *tree, void *user_data, size_t data_leng
 
 avlt_node_t *avl_tree_delete(avl_tree_t *tree, void *user_data, int (*cmp)(void *, void *), void (*del_data)(void *)) {
     tree->mutex_lock(tree->mutex);
-    tree->root = avlt_delete(tree->root, user_data, cmp, del_data);
+    tree->root = avlt_delete_ex(tree->root, user_data, cmp, del_data, tree->allocator);
     tree->mutex_unlock(tree->mutex);
     return tree->root;
 }
 
 void avl_tree_free(avl_tree_t *tree, void (*del_data)(void *)) {
     tree->mutex_lock(tree->mutex);
-    avlt_free_tree(tree->root, del_data);
+    avlt_free_tree_ex(tree->root, del_data, tree->allocator);
     tree->root = NULL;
     tree->mutex_unlock(tree->mutex);
     tree->mutex_destroy(tree->mutex);
@@ -45,12 +54,16 @@ void avl_tree_free(avl_tree_t *tree, void (*del_data)(void *)) {
 
 // Function to create a new node with user data
 avlt_node_t *avlt_create_node(size_t user_data_length_in_bytes) {
+    return avlt_create_node_ex(user_data_length_in_bytes, qwistys_allocator_default());
+}
+
+avlt_node_t *avlt_create_node_ex(size_t user_data_length_in_bytes, const qwistys_allocator_t *allocator) {
     QWISTYS_TELEMETRY_START();
-    avlt_node_t *node = (avlt_node_t *)qwistys_malloc(sizeof(avlt_node_t), NULL);
+    avlt_node_t *node = (avlt_node_t *)allocator->alloc(allocator->context, sizeof(avlt_node_t));
     if (!node) return NULL;
-    node->user_data = qwistys_malloc(user_data_length_in_bytes, NULL);
+    node->user_data = allocator->alloc(allocator->context, user_data_length_in_bytes);
     if (!node->user_data) {
-        qwistys_free(node);
+        allocator->free(allocator->context, node);
         return NULL;
     }
     node->height = 1;
@@ -106,8 +119,13 @@ avlt_node_t *avlt_left_rotate(avlt_node_t *x) {
 
 // Function to insert a new node
 avlt_node_t *avlt_insert(avlt_node_t *node, void *user_data, size_t data_length, int (*cmp)(void *, void *)) {
+    return avlt_insert_ex(node, user_data, data_length, cmp, qwistys_allocator_default());
+}
+
+avlt_node_t *avlt_insert_ex(avlt_node_t *node, void *user_data, size_t data_length, int (*cmp)(void *, void *),
+                            const qwistys_allocator_t *allocator) {
     if (!node) {
-        avlt_node_t *new_node = avlt_create_node(data_length);
+        avlt_node_t *new_node = avlt_create_node_ex(data_length, allocator);
         if (new_node) {
             memcpy(new_node->user_data, user_data, data_length);
         }
@@ -116,9 +134,9 @@ avlt_node_t *avlt_insert(avlt_node_t *node, void *user_data, size_t data_length,
 
     int cmp_result = cmp(user_data, node->user_data);
     if (cmp_result < 0) {
-        node->left = avlt_insert(node->left, user_data, data_length, cmp);
+        node->left = avlt_insert_ex(node->left, user_data, data_length, cmp, allocator);
     } else if (cmp_result > 0) {
-        node->right = avlt_insert(node->right, user_data, data_length, cmp);
+        node->right = avlt_insert_ex(node->right, user_data, data_length, cmp, allocator);
     } else {
         // Duplicate data, handle as necessary
         return node;
@@ -167,13 +185,18 @@ avlt_node_t *avlt_min_value_node(avlt_node_t *node) {
 
 // Function to delete a node
 avlt_node_t *avlt_delete(avlt_node_t *root, void *user_data, int (*cmp)(void *, void *), void (*del_data)(void *)) {
+    return avlt_delete_ex(root, user_data, cmp, del_data, qwistys_allocator_default());
+}
+
+avlt_node_t *avlt_delete_ex(avlt_node_t *root, void *user_data, int (*cmp)(void *, void *), void (*del_data)(void *),
+                            const qwistys_allocator_t *allocator) {
     if (!root) return NULL;
 
     int cmp_result = cmp(user_data, root->user_data);
     if (cmp_result < 0) {
-        root->left = avlt_delete(root->left, user_data, cmp, del_data);
+        root->left = avlt_delete_ex(root->left, user_data, cmp, del_data, allocator);
     } else if (cmp_result > 0) {
-        root->right = avlt_delete(root->right, user_data, cmp, del_data);
+        root->right = avlt_delete_ex(root->right, user_data, cmp, del_data, allocator);
     } else {
         if (!root->left || !root->right) {
             avlt_node_t *temp = root->left ? root->left : root->right;
@@ -184,12 +207,12 @@ avlt_node_t *avlt_delete(avlt_node_t *root, void *user_data, int (*cmp)(void *,
                 *root = *temp;
             }
             del_data(temp->user_data);
-            qwistys_free(temp->user_data);
-            qwistys_free(temp);
+            allocator->free(allocator->context, temp->user_data);
+            allocator->free(allocator->context, temp);
         } else {
             avlt_node_t *temp = avlt_min_value_node(root->right);
             memcpy(root->user_data, temp->user_data, sizeof(temp->user_data));
-            root->right = avlt_delete(root->right, temp->user_data, cmp, del_data);
+            root->right = avlt_delete_ex(root->right, temp->user_data, cmp, del_data, allocator);
         }
     }
 
@@ -263,13 +286,17 @@ void avlt_print(avlt_node_t *root, void (*print_node)(void *)) {
     }
 }
 void avlt_free_tree(avlt_node_t *root, void (*del_data)(void *)) {
+    avlt_free_tree_ex(root, del_data, qwistys_allocator_default());
+}
+
+void avlt_free_tree_ex(avlt_node_t *root, void (*del_data)(void *), const qwistys_allocator_t *allocator) {
     if (root) {
-        avlt_free_tree(root->left, del_data);  // Free left subtree
-        avlt_free_tree(root->right, del_data); // Free right subtree
+        avlt_free_tree_ex(root->left, del_data, allocator);  // Free left subtree
+        avlt_free_tree_ex(root->right, del_data, allocator); // Free right subtree
         if (del_data) {
             del_data(root->user_data); // Free user data if needed
         }
-        qwistys_free(root->user_data); // Free the user data
-        qwistys_free(root); // Free the node itself
+        allocator->free(allocator->context, root->user_data); // Free the user data
+        allocator->free(allocator->context, root); // Free the node itself
     }
 }
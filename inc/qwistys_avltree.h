@@ -7,6 +7,7 @@ extern "C" {
 
 #include "qwistys_api.h"
 #include "qwistys_macros.h"
+#include "qwistys_alloc.h"
 
 // AVL tree node structure
 typedef struct avlt_node_t {
@@ -27,6 +28,7 @@ typedef void (*qwistys_mutex_unlock_fn)(qwistys_mutex_t *mutex);
 
 typedef struct {
     avlt_node_t *root;
+    const qwistys_allocator_t *allocator; // Source of nodes and their user data
     qwistys_mutex_t *mutex;
     qwistys_mutex_init_fn mutex_init;
     qwistys_mutex_destroy_fn mutex_destroy;
@@ -49,12 +51,26 @@ API_IMPL void avlt_post_order(avlt_node_t *root, void (*process_node)(void *));
 API_IMPL void avlt_print(avlt_node_t *root, void (*print_node)(void *));
 API_IMPL void avlt_free_tree(avlt_node_t *root, void (*del_data)(void *));
 
+// Same as above on a given allocator, a tree must be freed with the one it was built with
+API_IMPL avlt_node_t *avlt_create_node_ex(size_t user_data_length_in_bytes, const qwistys_allocator_t *allocator);
+API_IMPL avlt_node_t *avlt_insert_ex(avlt_node_t *node, void *user_data, size_t data_length, int (*cmp)(void *, void *),
+                                     const qwistys_allocator_t *allocator);
+API_IMPL avlt_node_t *avlt_delete_ex(avlt_node_t *root, void *user_data, int (*cmp)(void *, void *), void (*del_data)(void *),
+                                     const qwistys_allocator_t *allocator);
+API_IMPL void avlt_free_tree_ex(avlt_node_t *root, void (*del_data)(void *), const qwistys_allocator_t *allocator);
+
 // Function prototypes for thread-safe operations
 API_IMPL void avl_tree_init(avl_tree_t *tree, qwistys_mutex_t *mutex,
                    qwistys_mutex_init_fn init_fn,
                    qwistys_mutex_destroy_fn destroy_fn,
                    qwistys_mutex_lock_fn lock_fn,
                    qwistys_mutex_unlock_fn unlock_fn);
+// allocator NULL means qwistys_allocator_default(), it must outlive the tree
+API_IMPL void avl_tree_init_ex(avl_tree_t *tree, const qwistys_allocator_t *allocator, qwistys_mutex_t *mutex,
+                      qwistys_mutex_init_fn init_fn,
+                      qwistys_mutex_destroy_fn destroy_fn,
+                      qwistys_mutex_lock_fn lock_fn,
+                      qwistys_mutex_unlock_fn unlock_fn);
 API_IMPL avlt_node_t *avl_tree_insert(avl_tree_t *tree, void *user_data, size_t data_length, int (*cmp)(void *, void *));
 API_IMPL avlt_node_t *avl_tree_delete(avl_tree_t *tree, void *user_data, int (*cmp)(void *, void *), void (*del_data)(void *));
 API_IMPL void avl_tree_free(avl_tree_t *tree, void (*del_data)(void *));
@@ -0,0 +1,359 @@
+#include "qwistys_cstack.h"
+#include <pthread.h>
+#include <string.h>
+
+// Node index 0 is the empty list, node i is stored at slot i - 1
+#define CSTACK_NIL 0u
+
+#define CSTACK_HEAD(tag, index) (((uint64_t)(tag) << 32) | (uint32_t)(index))
+#define CSTACK_HEAD_TAG(head) ((uint32_t)((head) >> 32))
+#define CSTACK_HEAD_INDEX(head) ((uint32_t)(head))
+
+// Node limit of a growing stack, only those cache popped nodes
+#define CSTACK_UNBOUNDED (UINT32_MAX - 1)
+
+// Most pause rounds between two attempts of a CAS that lost a race
+#define CSTACK_BACKOFF_MAX 64u
+
+// Each thread owns one cache slot number, the same in every stack, so slots
+// are read and written without a CAS. Numbers are claimed on the first push
+// or pop and given back when the thread exits; threads past
+// QWISTYS_CSTACK_CACHE_SLOTS go without a cache.
+#define CSTACK_SLOT_UNSET 0
+#define CSTACK_SLOT_NONE (QWISTYS_CSTACK_CACHE_SLOTS + 1)
+
+static uint32_t cstack_slots_taken;
+static __thread unsigned cstack_slot; // Slot number + 1, or one of the above
+static pthread_once_t cstack_slot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cstack_slot_key;
+
+typedef struct {
+    uint32_t next; // Written and read atomically, a popper may race a pusher of the same node
+    uint32_t unused; // Keeps the item 8 byte aligned
+} cstack_node_t;
+
+// Chunk c holds (1 << base_shift) << c nodes, like flexa_seg_t
+static inline char *cstack_node(qwistys_cstack_t *stack, uint32_t index) {
+    size_t shifted = (size_t)(index - 1) + ((size_t)1 << stack->base_shift);
+    unsigned high_bit = (unsigned)(63 - __builtin_clzll((unsigned long long)shifted));
+    size_t offset = shifted - ((size_t)1 << high_bit);
+    char *chunk = __atomic_load_n(&stack->chunks[high_bit - stack->base_shift], __ATOMIC_ACQUIRE);
+    return chunk + (offset * stack->node_size);
+}
+
+static inline void *cstack_node_item(char *node) {
+    return node + sizeof(cstack_node_t);
+}
+
+// Runs when a thread exits, nodes it parked stay for the next owner of the number
+static void cstack_slot_release(void *arg) {
+    unsigned slot = (unsigned)(uintptr_t)arg - 1;
+    __atomic_fetch_and(&cstack_slots_taken, ~(1u << slot), __ATOMIC_RELEASE);
+}
+
+static void cstack_slot_make_key(void) {
+    pthread_key_create(&cstack_slot_key, cstack_slot_release);
+}
+
+static void cstack_slot_claim(void) {
+    cstack_slot = CSTACK_SLOT_NONE;
+    uint32_t taken = __atomic_load_n(&cstack_slots_taken, __ATOMIC_RELAXED);
+    for (;;) {
+        uint32_t free_slots = ~taken & ((1u << QWISTYS_CSTACK_CACHE_SLOTS) - 1);
+        if (!free_slots) {
+            return;
+        }
+        unsigned slot = (unsigned)__builtin_ctz(free_slots);
+        // Acquire pairs with the release of the previous owner
+        if (__atomic_compare_exchange_n(&cstack_slots_taken, &taken, taken | (1u << slot), 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            pthread_once(&cstack_slot_once, cstack_slot_make_key);
+            pthread_setspecific(cstack_slot_key, (void *)(uintptr_t)(slot + 1));
+            cstack_slot = slot + 1;
+            return;
+        }
+    }
+}
+
+// Cache slot of the calling thread, NULL if it has none or the stack is bounded
+static inline uint32_t *cstack_cache_slot(qwistys_cstack_t *stack) {
+    if (stack->limit != CSTACK_UNBOUNDED) {
+        return NULL;
+    }
+    if (cstack_slot == CSTACK_SLOT_UNSET) {
+        cstack_slot_claim();
+    }
+    if (cstack_slot == CSTACK_SLOT_NONE) {
+        return NULL;
+    }
+    return &stack->cache[cstack_slot - 1].index;
+}
+
+// Waits a little longer after every lost race, so threads stop colliding on the head
+static inline void cstack_backoff(unsigned *rounds) {
+    for (unsigned i = 0; i < *rounds; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        __asm__ __volatile__("" ::: "memory");
+#endif
+    }
+    if (*rounds < CSTACK_BACKOFF_MAX) {
+        *rounds <<= 1;
+    }
+}
+
+// Items are copied with relaxed atomic word and byte accesses, peek may
+// read a node a pusher is writing. Items start 8 byte aligned.
+static void cstack_item_store(char *node, const void *item, size_t item_size) {
+    uint64_t *words = (uint64_t *)cstack_node_item(node);
+    size_t count = item_size / sizeof(uint64_t);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t word;
+        memcpy(&word, (const char *)item + (i * sizeof(word)), sizeof(word));
+        __atomic_store_n(&words[i], word, __ATOMIC_RELAXED);
+    }
+    unsigned char *bytes = (unsigned char *)cstack_node_item(node);
+    for (size_t i = count * sizeof(uint64_t); i < item_size; i++) {
+        __atomic_store_n(&bytes[i], ((const unsigned char *)item)[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void cstack_item_load(char *node, void *item, size_t item_size) {
+    uint64_t *words = (uint64_t *)cstack_node_item(node);
+    size_t count = item_size / sizeof(uint64_t);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t word = __atomic_load_n(&words[i], __ATOMIC_RELAXED);
+        memcpy((char *)item + (i * sizeof(word)), &word, sizeof(word));
+    }
+    unsigned char *bytes = (unsigned char *)cstack_node_item(node);
+    for (size_t i = count * sizeof(uint64_t); i < item_size; i++) {
+        ((unsigned char *)item)[i] = __atomic_load_n(&bytes[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void cstack_list_push(qwistys_cstack_t *stack, uint64_t *head, uint32_t index) {
+    cstack_node_t *node = (cstack_node_t *)cstack_node(stack, index);
+    uint64_t old = __atomic_load_n(head, __ATOMIC_RELAXED);
+    unsigned rounds = 1;
+    for (;;) {
+        __atomic_store_n(&node->next, CSTACK_HEAD_INDEX(old), __ATOMIC_RELAXED);
+        uint64_t updated = CSTACK_HEAD(CSTACK_HEAD_TAG(old) + 1, index);
+        // Release publishes the item and next, on failure old is reloaded
+        if (__atomic_compare_exchange_n(head, &old, updated, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        cstack_backoff(&rounds);
+        old = __atomic_load_n(head, __ATOMIC_RELAXED);
+    }
+}
+
+static uint32_t cstack_list_pop(qwistys_cstack_t *stack, uint64_t *head) {
+    uint64_t old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    unsigned rounds = 1;
+    for (;;) {
+        uint32_t index = CSTACK_HEAD_INDEX(old);
+        if (index == CSTACK_NIL) {
+            return CSTACK_NIL;
+        }
+        // The node may already be taken and reused, its memory stays valid
+        // and the tag makes the CAS fail in that case
+        cstack_node_t *node = (cstack_node_t *)cstack_node(stack, index);
+        uint32_t next = __atomic_load_n(&node->next, __ATOMIC_RELAXED);
+        uint64_t updated = CSTACK_HEAD(CSTACK_HEAD_TAG(old) + 1, next);
+        if (__atomic_compare_exchange_n(head, &old, updated, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return index;
+        }
+        cstack_backoff(&rounds);
+        old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    }
+}
+
+// Recycled node or a fresh one, the chunk of a fresh node is installed by
+// the first thread to need it
+static uint32_t cstack_node_alloc(qwistys_cstack_t *stack) {
+    uint32_t index = cstack_list_pop(stack, &stack->free_head);
+    if (index != CSTACK_NIL) {
+        return index;
+    }
+
+    uint32_t slot = __atomic_load_n(&stack->allocated, __ATOMIC_RELAXED);
+    do {
+        if (slot >= stack->limit) {
+            return CSTACK_NIL;
+        }
+    } while (!__atomic_compare_exchange_n(&stack->allocated, &slot, slot + 1, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+
+    size_t shifted = (size_t)slot + ((size_t)1 << stack->base_shift);
+    unsigned chunk = (unsigned)(63 - __builtin_clzll((unsigned long long)shifted)) - stack->base_shift;
+    char *data = __atomic_load_n(&stack->chunks[chunk], __ATOMIC_ACQUIRE);
+    if (!data) {
+        const qwistys_allocator_t *allocator = stack->allocator;
+        size_t nodes = (size_t)1 << (stack->base_shift + chunk);
+        char *fresh = (char *)allocator->alloc(allocator->context, nodes * stack->node_size);
+        if (!fresh) {
+            QWISTYS_HALT("Memory allocation failed for stack nodes");
+            return CSTACK_NIL;
+        }
+        if (!__atomic_compare_exchange_n(&stack->chunks[chunk], &data, fresh, 0, __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            allocator->free(allocator->context, fresh);
+        }
+    }
+    return slot + 1;
+}
+
+static qwistys_cstack_t *cstack_create(size_t item_size, size_t first_chunk, uint32_t limit,
+                                       const qwistys_allocator_t *allocator) {
+    QWISTYS_ASSERT(item_size > 0);
+    QWISTYS_ASSERT(first_chunk > 0 && first_chunk <= limit);
+
+    if (!allocator) {
+        allocator = qwistys_allocator_default();
+    }
+    // The heads are cache line aligned, the struct has to be as well
+    qwistys_cstack_t *stack = (qwistys_cstack_t *)qwistys_aligned_alloc(QWISTYS_CACHE_LINE, sizeof(qwistys_cstack_t), NULL);
+    if (!stack) {
+        QWISTYS_HALT("Memory allocation failed for stack");
+        return NULL;
+    }
+    memset(stack, 0, sizeof(*stack));
+    stack->item_size = item_size;
+    stack->node_size = (sizeof(cstack_node_t) + item_size + 7) & ~(size_t)7;
+    stack->limit = limit;
+    stack->allocator = allocator;
+    while (((size_t)1 << stack->base_shift) < first_chunk) {
+        stack->base_shift++;
+    }
+
+    stack->chunks[0] = (char *)allocator->alloc(allocator->context, ((size_t)1 << stack->base_shift) * stack->node_size);
+    if (!stack->chunks[0]) {
+        qwistys_aligned_free(stack);
+        QWISTYS_HALT("Memory allocation failed for stack nodes");
+        return NULL;
+    }
+    return stack;
+}
+
+qwistys_cstack_t *qwistys_cstack_init(size_t item_size, size_t initial_capacity) {
+    return qwistys_cstack_init_ex(item_size, initial_capacity, NULL);
+}
+
+qwistys_cstack_t *qwistys_cstack_init_ex(size_t item_size, size_t initial_capacity,
+                                         const qwistys_allocator_t *allocator) {
+    QWISTYS_TELEMETRY_START();
+    qwistys_cstack_t *stack = cstack_create(item_size, initial_capacity, CSTACK_UNBOUNDED, allocator);
+    QWISTYS_DEBUG_MSG("Concurrent stack initialized");
+    QWISTYS_TELEMETRY_END();
+    return stack;
+}
+
+qwistys_cstack_t *qwistys_cstack_init_bounded(size_t item_size, size_t capacity,
+                                              const qwistys_allocator_t *allocator) {
+    QWISTYS_ASSERT(capacity < CSTACK_UNBOUNDED);
+    QWISTYS_TELEMETRY_START();
+    qwistys_cstack_t *stack = cstack_create(item_size, capacity, (uint32_t)capacity, allocator);
+    QWISTYS_DEBUG_MSG("Bounded concurrent stack initialized");
+    QWISTYS_TELEMETRY_END();
+    return stack;
+}
+
+void qwistys_cstack_free(qwistys_cstack_t *stack) {
+    QWISTYS_ASSERT(stack != NULL);
+    QWISTYS_TELEMETRY_START();
+
+    const qwistys_allocator_t *allocator = stack->allocator;
+    for (unsigned i = 0; i < QWISTYS_CSTACK_MAX_CHUNKS; i++) {
+        if (stack->chunks[i]) {
+            allocator->free(allocator->context, stack->chunks[i]);
+        }
+    }
+    qwistys_aligned_free(stack);
+
+    QWISTYS_DEBUG_MSG("Concurrent stack freed");
+    QWISTYS_TELEMETRY_END();
+}
+
+int qwistys_cstack_push(qwistys_cstack_t *stack, const void *item) {
+    QWISTYS_ASSERT(stack != NULL);
+    QWISTYS_ASSERT(item != NULL);
+
+    uint32_t *slot = cstack_cache_slot(stack);
+    uint32_t index = slot ? __atomic_load_n(slot, __ATOMIC_RELAXED) : CSTACK_NIL;
+    if (index != CSTACK_NIL) {
+        __atomic_store_n(slot, CSTACK_NIL, __ATOMIC_RELAXED);
+    } else {
+        index = cstack_node_alloc(stack);
+    }
+    if (index == CSTACK_NIL) {
+        QWISTYS_DEBUG_MSG("Concurrent stack is full");
+        return -1;
+    }
+    cstack_item_store(cstack_node(stack, index), item, stack->item_size);
+    cstack_list_push(stack, &stack->head, index);
+    return 0;
+}
+
+int qwistys_cstack_pop(qwistys_cstack_t *stack, void *item) {
+    QWISTYS_ASSERT(stack != NULL);
+    QWISTYS_ASSERT(item != NULL);
+
+    uint32_t index = cstack_list_pop(stack, &stack->head);
+    if (index == CSTACK_NIL) {
+        return -1;
+    }
+    memcpy(item, cstack_node_item(cstack_node(stack, index)), stack->item_size);
+    // The free list only gets the node if the slot already holds one
+    uint32_t *slot = cstack_cache_slot(stack);
+    if (slot && __atomic_load_n(slot, __ATOMIC_RELAXED) == CSTACK_NIL) {
+        __atomic_store_n(slot, index, __ATOMIC_RELAXED);
+    } else {
+        cstack_list_push(stack, &stack->free_head, index);
+    }
+    return 0;
+}
+
+int qwistys_cstack_peek(qwistys_cstack_t *stack, void *item) {
+    QWISTYS_ASSERT(stack != NULL);
+    QWISTYS_ASSERT(item != NULL);
+
+    uint64_t head = __atomic_load_n(&stack->head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t index = CSTACK_HEAD_INDEX(head);
+        if (index == CSTACK_NIL) {
+            return -1;
+        }
+        cstack_item_load(cstack_node(stack, index), item, stack->item_size);
+        // The copy is only good if the node was still on top after it. The
+        // fence keeps the loads of the copy before the head is read again.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t again = __atomic_load_n(&stack->head, __ATOMIC_RELAXED);
+        if (again == head) {
+            return 0;
+        }
+        head = again;
+    }
+}
+
+size_t qwistys_cstack_size(qwistys_cstack_t *stack) {
+    QWISTYS_ASSERT(stack != NULL);
+
+    // Counted here rather than on every push and pop. A list changing under
+    // the walk can send it round in circles, no more nodes than ever handed
+    // out are counted.
+    size_t limit = __atomic_load_n(&stack->allocated, __ATOMIC_ACQUIRE);
+    uint32_t index = CSTACK_HEAD_INDEX(__atomic_load_n(&stack->head, __ATOMIC_ACQUIRE));
+    size_t size = 0;
+    while (index != CSTACK_NIL && size < limit) {
+        cstack_node_t *node = (cstack_node_t *)cstack_node(stack, index);
+        index = __atomic_load_n(&node->next, __ATOMIC_RELAXED);
+        size++;
+    }
+    return size;
+}
+
+int qwistys_cstack_is_empty(qwistys_cstack_t *stack) {
+    QWISTYS_ASSERT(stack != NULL);
+    return CSTACK_HEAD_INDEX(__atomic_load_n(&stack->head, __ATOMIC_ACQUIRE)) == CSTACK_NIL;
+}
@@ -0,0 +1,65 @@
+#ifndef QWISTYS_CSTACK_H
+#define QWISTYS_CSTACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "qwistys_api.h"
+#include "qwistys_macros.h"
+#include "qwistys_alloc.h"
+
+#define QWISTYS_CSTACK_MAX_CHUNKS 32
+#define QWISTYS_CSTACK_CACHE_SLOTS 16
+
+// One popped node kept for the next push of the thread owning the slot
+typedef struct {
+    uint32_t index __attribute__((aligned(QWISTYS_CACHE_LINE)));
+} qwistys_cstack_slot_t;
+
+// Lock-free (Treiber) stack. Nodes live in chunks that are only freed with
+// the stack and are named by a 32 bit index; a head is {tag, index} in one
+// 64 bit word and the tag changes on every update, so a node popped and
+// pushed again between a load and a CAS (ABA) fails the CAS. On a growing
+// stack a pop parks its node in the slot of its thread and the next push
+// takes it back, neither touches the shared free list.
+typedef struct {
+    uint64_t head __attribute__((aligned(QWISTYS_CACHE_LINE)));      // Items
+    uint64_t free_head __attribute__((aligned(QWISTYS_CACHE_LINE))); // Recycled nodes
+    uint32_t allocated __attribute__((aligned(QWISTYS_CACHE_LINE))); // Nodes ever handed out
+    size_t item_size;
+    size_t node_size;
+    uint32_t limit;       // Most nodes, capacity of a bounded stack
+    unsigned base_shift;  // log2 of the nodes in the first chunk
+    const qwistys_allocator_t *allocator;
+    char *chunks[QWISTYS_CSTACK_MAX_CHUNKS];
+    qwistys_cstack_slot_t cache[QWISTYS_CSTACK_CACHE_SLOTS];
+} qwistys_cstack_t;
+
+// Function prototypes, all but init and free are safe from any thread
+API_IMPL qwistys_cstack_t *qwistys_cstack_init(size_t item_size, size_t initial_capacity);
+// allocator NULL means qwistys_allocator_default(), it is called from pushing threads.
+// It provides the nodes, the struct is cache line aligned and comes from qwistys_aligned_alloc.
+API_IMPL qwistys_cstack_t *qwistys_cstack_init_ex(size_t item_size, size_t initial_capacity,
+                                                  const qwistys_allocator_t *allocator);
+// Array-based variant: all capacity nodes are allocated up front, push fails when full
+API_IMPL qwistys_cstack_t *qwistys_cstack_init_bounded(size_t item_size, size_t capacity,
+                                                       const qwistys_allocator_t *allocator);
+API_IMPL void qwistys_cstack_free(qwistys_cstack_t *stack);
+API_IMPL int qwistys_cstack_push(qwistys_cstack_t *stack, const void *item);
+API_IMPL int qwistys_cstack_pop(qwistys_cstack_t *stack, void *item);
+// Copy of the top item, retried if the top changes while copying. The copy
+// was on top at some point, unlike pop it does not take the item.
+API_IMPL int qwistys_cstack_peek(qwistys_cstack_t *stack, void *item);
+// Walks the list, O(n). Exact while no other thread changes the stack,
+// an estimate otherwise.
+API_IMPL size_t qwistys_cstack_size(qwistys_cstack_t *stack);
+API_IMPL int qwistys_cstack_is_empty(qwistys_cstack_t *stack);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QWISTYS_CSTACK_H
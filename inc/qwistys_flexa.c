@@ -1,10 +1,157 @@
+#define _GNU_SOURCE
 #include "qwistys_flexa.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FLEXA_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+static const flexa_growth_t flexa_default_growth = {2.0, 0, 0};
+
+// Gives back a policy flexa_set_growth allocated for the array
+static void flexa_release_growth(flexa_t *array) {
+  if (array->growth != &flexa_default_growth) {
+    array->allocator->free(array->allocator->context, (void *)array->growth);
+    array->growth = &flexa_default_growth;
+  }
+}
+
+// Granularity pages of a reserved array are committed in
+static size_t flexa_commit_unit(int reserve_flags) {
+  if (reserve_flags & FLEXA_RESERVE_HUGE_PAGES) {
+    return FLEXA_HUGE_PAGE_SIZE;
+  }
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Commits or decommits the pages of a reserved array, data never moves
+static int flexa_commit(flexa_t *array, size_t new_capacity) {
+  size_t unit = flexa_commit_unit(array->reserve_flags);
+  size_t old_bytes = QWISTYS_ALLOC_ALIGN_TO(array->capacity * array->item_size, unit);
+  size_t new_bytes = QWISTYS_ALLOC_ALIGN_TO(new_capacity * array->item_size, unit);
+  QWISTYS_ASSERT(new_bytes <= array->backing.reserved);
+
+  char *data = (char *)array->data;
+  if (new_bytes > old_bytes) {
+    if (mprotect(data + old_bytes, new_bytes - old_bytes, PROT_READ | PROT_WRITE) != 0) {
+      QWISTYS_ERROR_MSG("Failed to commit %zu bytes of reserved array", new_bytes - old_bytes);
+      return -1;
+    }
+  } else if (new_bytes < old_bytes) {
+    madvise(data + new_bytes, old_bytes - new_bytes, MADV_DONTNEED);
+    mprotect(data + new_bytes, old_bytes - new_bytes, PROT_NONE);
+  }
+  // Whole committed units are usable
+  array->capacity = new_bytes / array->item_size;
+  return 0;
+}
+
+// File layout of a mapped array: this header, then capacity items
+#define FLEXA_FILE_MAGIC 0x41584C46u // "FLXA"
+#define FLEXA_FILE_VERSION 1u
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t item_size;
+  uint64_t size;      // Items as of the last flexa_sync
+  uint64_t capacity;  // Items the file has room for
+  uint64_t checksum;  // Of the fields above and the items, written by flexa_sync
+  uint64_t reserved[3];
+} flexa_file_header_t; // 64 bytes, items start cache line aligned
+
+static inline flexa_file_header_t *flexa_file_header(flexa_t *array) {
+  return (flexa_file_header_t *)((char *)array->data - sizeof(flexa_file_header_t));
+}
+
+static inline size_t flexa_file_length(size_t item_size, size_t capacity) {
+  return sizeof(flexa_file_header_t) + (capacity * item_size);
+}
+
+// FNV-1a over 64 bit words, the tail byte by byte
+static uint64_t flexa_checksum(const flexa_file_header_t *header, const void *data,
+                               size_t bytes) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  uint64_t fields[3] = {header->item_size, header->size, header->capacity};
+  for (size_t i = 0; i < 3; i++) {
+    hash = (hash ^ fields[i]) * 0x100000001B3ull;
+  }
+  const unsigned char *bytes_in = (const unsigned char *)data;
+  size_t words = bytes / sizeof(uint64_t);
+  for (size_t i = 0; i < words; i++) {
+    uint64_t word;
+    memcpy(&word, bytes_in + (i * sizeof(word)), sizeof(word));
+    hash = (hash ^ word) * 0x100000001B3ull;
+  }
+  for (size_t i = words * sizeof(uint64_t); i < bytes; i++) {
+    hash = (hash ^ bytes_in[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+// Grows or shrinks the file of a mapped array and maps it again
+static int flexa_remap(flexa_t *array, size_t new_capacity) {
+  char *base = (char *)flexa_file_header(array);
+  size_t old_length = flexa_file_length(array->item_size, array->capacity);
+  size_t new_length = flexa_file_length(array->item_size, new_capacity);
+
+  if (new_length > old_length && ftruncate(array->backing.fd, (off_t)new_length) != 0) {
+    QWISTYS_ERROR_MSG("Failed to extend mapped array to %zu bytes", new_length);
+    return -1;
+  }
+  void *moved = mremap(base, old_length, new_length, MREMAP_MAYMOVE);
+  if (moved == MAP_FAILED) {
+    if (new_length > old_length && ftruncate(array->backing.fd, (off_t)old_length) != 0) {
+      QWISTYS_ERROR_MSG("Failed to restore mapped array length");
+    }
+    QWISTYS_ERROR_MSG("Failed to remap array to %zu bytes", new_length);
+    return -1;
+  }
+  if (new_length < old_length && ftruncate(array->backing.fd, (off_t)new_length) != 0) {
+    QWISTYS_ERROR_MSG("Failed to truncate mapped array to %zu bytes", new_length);
+  }
+
+  array->data = (char *)moved + sizeof(flexa_file_header_t);
+  array->capacity = new_capacity;
+  flexa_file_header(array)->capacity = new_capacity;
+  return 0;
+}
 
 static int flexa_resize(flexa_t *array, size_t new_capacity) {
   QWISTYS_DEBUG_MSG("Resizing array");
   QWISTYS_TELEMETRY_START();
 
-  void *new_data = realloc(array->data, new_capacity * array->item_size);
+  if (array->kind == FLEXA_BACKING_RESERVED) {
+    int result = flexa_commit(array, new_capacity);
+    QWISTYS_TELEMETRY_END();
+    return result;
+  }
+  if (array->kind == FLEXA_BACKING_MAPPED) {
+    int result = flexa_remap(array, new_capacity);
+    QWISTYS_TELEMETRY_END();
+    return result;
+  }
+
+  void *new_data;
+  if (array->data == array->backing.buffer) {
+    if (new_capacity <= array->capacity) {
+      // Inline storage is kept, it costs nothing
+      QWISTYS_TELEMETRY_END();
+      return 0;
+    }
+    // Spill to the allocator, the buffer is not used again
+    new_data = array->allocator->alloc(array->allocator->context,
+                                       new_capacity * array->item_size);
+    if (new_data) {
+      memcpy(new_data, array->data, array->size * array->item_size);
+    }
+  } else {
+    new_data = array->allocator->realloc(
+        array->allocator->context, array->data,
+        array->capacity * array->item_size, new_capacity * array->item_size);
+  }
   if (!new_data) {
     QWISTYS_HALT("Memory allocation failed during resize");
     return -1;
@@ -18,34 +165,321 @@ static int flexa_resize(flexa_t *array, size_t new_capacity) {
   return 0;
 }
 
+// Single capacity adjustment for needed items, sized by the growth policy
+static int flexa_grow(flexa_t *array, size_t needed) {
+  if (needed <= array->capacity) {
+    return 0;
+  }
+  const flexa_growth_t *growth = array->growth;
+  size_t capacity = array->capacity;
+  size_t new_capacity;
+  if (growth->increment &&
+      (growth->factor <= 1.0 || (growth->linear_after && capacity >= growth->linear_after))) {
+    new_capacity = capacity + growth->increment;
+  } else {
+    new_capacity = (size_t)((double)capacity * growth->factor);
+    if (growth->linear_after && capacity < growth->linear_after) {
+      // The last multiplied step does not overshoot the cap
+      new_capacity = QWISTYS_MIN(new_capacity, growth->linear_after);
+    }
+  }
+  if (new_capacity < needed) {
+    new_capacity = needed;
+  }
+  if (array->kind == FLEXA_BACKING_RESERVED) {
+    size_t limit = array->backing.reserved / array->item_size;
+    if (needed > limit) {
+      QWISTYS_DEBUG_MSG("Reserved array is full at %zu items", limit);
+      return -1;
+    }
+    new_capacity = QWISTYS_MIN(new_capacity, limit);
+  }
+  return flexa_resize(array, new_capacity);
+}
+
 flexa_t *flexa_init(size_t item_size, size_t initial_capacity) {
+  return flexa_init_ex(item_size, initial_capacity, NULL);
+}
+
+flexa_t *flexa_init_ex(size_t item_size, size_t initial_capacity,
+                       const qwistys_allocator_t *allocator) {
   QWISTYS_ASSERT(item_size > 0);
   QWISTYS_ASSERT(initial_capacity > 0);
 
   QWISTYS_TELEMETRY_START();
 
-  flexa_t *array = (flexa_t*)malloc(sizeof(flexa_t));
+  if (!allocator) {
+    allocator = qwistys_allocator_default();
+  }
+
+  flexa_t *array = (flexa_t*)allocator->alloc(allocator->context, sizeof(flexa_t));
   if (!array) {
     QWISTYS_HALT("Memory allocation failed during initialization");
     return NULL;
   }
+  if (flexa_init_inline(array, item_size, NULL, initial_capacity, allocator) != 0) {
+    allocator->free(allocator->context, array);
+    return NULL;
+  }
+
+  QWISTYS_DEBUG_MSG("Array initialized successfully");
+  QWISTYS_TELEMETRY_END();
+
+  return array;
+}
+
+int flexa_init_inline(flexa_t *array, size_t item_size, void *buffer,
+                      size_t capacity, const qwistys_allocator_t *allocator) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(item_size > 0);
+  QWISTYS_ASSERT(capacity > 0);
+
+  if (!allocator) {
+    allocator = qwistys_allocator_default();
+  }
 
   array->item_size = item_size;
-  array->capacity = initial_capacity;
+  array->capacity = capacity;
   array->size = 0;
-  array->data = malloc(array->capacity * item_size);
+  array->allocator = allocator;
+  array->growth = &flexa_default_growth;
+  array->kind = FLEXA_BACKING_HEAP;
+  array->reserve_flags = 0;
+  array->backing.buffer = buffer;
+  array->data = buffer ? buffer : allocator->alloc(allocator->context, capacity * item_size);
   if (!array->data) {
-    free(array);
     QWISTYS_HALT("Memory allocation failed during data initialization");
+    return -1;
+  }
+  return 0;
+}
+
+void flexa_deinit(flexa_t *array) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(array->kind == FLEXA_BACKING_HEAP);
+
+  if (array->data != array->backing.buffer) {
+    array->allocator->free(array->allocator->context, array->data);
+  }
+  flexa_release_growth(array);
+  array->data = array->backing.buffer;
+  array->size = 0;
+}
+
+flexa_t *flexa_init_reserved(size_t item_size, size_t max_items,
+                             int reserve_flags) {
+  QWISTYS_ASSERT(item_size > 0);
+  QWISTYS_ASSERT(max_items > 0);
+
+  QWISTYS_TELEMETRY_START();
+
+  size_t unit = flexa_commit_unit(reserve_flags);
+  size_t reserved;
+  if (__builtin_mul_overflow(item_size, max_items, &reserved) ||
+      reserved > SIZE_MAX - 2 * unit) {
+    QWISTYS_ERROR_MSG("Reservation of %zu items is too big", max_items);
+    QWISTYS_TELEMETRY_END();
     return NULL;
   }
+  reserved = QWISTYS_ALLOC_ALIGN_TO(reserved, unit);
 
-  QWISTYS_DEBUG_MSG("Array initialized successfully");
+  const qwistys_allocator_t *allocator = qwistys_allocator_default();
+  flexa_t *array = (flexa_t*)allocator->alloc(allocator->context, sizeof(flexa_t));
+  if (!array) {
+    QWISTYS_HALT("Memory allocation failed during initialization");
+    return NULL;
+  }
+
+  // Address space only, pages are committed by flexa_commit. Huge pages
+  // need a range aligned to their size, the slack around it is given back.
+  size_t slack = unit > (size_t)sysconf(_SC_PAGESIZE) ? unit : 0;
+  char *range = (char *)mmap(NULL, reserved + slack, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (range == MAP_FAILED) {
+    allocator->free(allocator->context, array);
+    QWISTYS_ERROR_MSG("Failed to reserve %zu bytes", reserved);
+    QWISTYS_TELEMETRY_END();
+    return NULL;
+  }
+  char *data = range;
+  if (slack) {
+    data = (char *)QWISTYS_ALLOC_ALIGN_TO((uintptr_t)range, unit);
+    if (data != range) {
+      munmap(range, (size_t)(data - range));
+    }
+    if (range + slack != data) {
+      munmap(data + reserved, (size_t)(range + slack - data));
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(data, reserved, MADV_HUGEPAGE);
+#endif
+  }
+
+  array->item_size = item_size;
+  array->capacity = 0;
+  array->size = 0;
+  array->data = data;
+  array->allocator = allocator;
+  array->growth = &flexa_default_growth;
+  array->kind = FLEXA_BACKING_RESERVED;
+  array->reserve_flags = (uint16_t)reserve_flags;
+  array->backing.reserved = reserved;
+
+  QWISTYS_DEBUG_MSG("Reserved %zu bytes for array", reserved);
+  QWISTYS_TELEMETRY_END();
+
+  return array;
+}
+
+flexa_t *flexa_open_mapped(const char *path, size_t item_size, int map_flags) {
+  QWISTYS_ASSERT(path != NULL);
+  QWISTYS_ASSERT(item_size > 0);
+
+  QWISTYS_TELEMETRY_START();
+
+  int open_flags = O_RDWR | O_CLOEXEC;
+  if (map_flags & FLEXA_MAP_CREATE) {
+    open_flags |= O_CREAT;
+  }
+  if (map_flags & FLEXA_MAP_TRUNCATE) {
+    open_flags |= O_TRUNC;
+  }
+  int fd = open(path, open_flags, 0644);
+  if (fd < 0) {
+    QWISTYS_ERROR_MSG("Failed to open mapped array %s", path);
+    QWISTYS_TELEMETRY_END();
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    QWISTYS_ERROR_MSG("Failed to stat mapped array %s", path);
+    QWISTYS_TELEMETRY_END();
+    return NULL;
+  }
+  size_t length = (size_t)st.st_size;
+  int fresh = length == 0;
+  if (fresh) {
+    // A new file starts with a page worth of items
+    size_t capacity = QWISTYS_MAX((size_t)sysconf(_SC_PAGESIZE) / item_size, (size_t)1);
+    length = flexa_file_length(item_size, capacity);
+    if (ftruncate(fd, (off_t)length) != 0) {
+      close(fd);
+      QWISTYS_ERROR_MSG("Failed to size mapped array %s", path);
+      QWISTYS_TELEMETRY_END();
+      return NULL;
+    }
+  } else if (length < sizeof(flexa_file_header_t)) {
+    close(fd);
+    QWISTYS_ERROR_MSG("%s is too short for a mapped array", path);
+    QWISTYS_TELEMETRY_END();
+    return NULL;
+  }
+
+  char *base = (char *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    QWISTYS_ERROR_MSG("Failed to map %s", path);
+    QWISTYS_TELEMETRY_END();
+    return NULL;
+  }
+
+  flexa_file_header_t *header = (flexa_file_header_t *)base;
+  // The file length is the truth for the capacity, the header may lag
+  // behind it if the process died in the middle of a resize
+  size_t capacity = (length - sizeof(flexa_file_header_t)) / item_size;
+  if (fresh) {
+    memset(header, 0, sizeof(*header));
+    header->magic = FLEXA_FILE_MAGIC;
+    header->version = FLEXA_FILE_VERSION;
+    header->item_size = item_size;
+    header->capacity = capacity;
+  }
+  const char *problem = NULL;
+  if (header->magic != FLEXA_FILE_MAGIC || header->version != FLEXA_FILE_VERSION) {
+    problem = "not a mapped array";
+  } else if (header->item_size != item_size) {
+    problem = "written with another item size";
+  } else if (header->size > capacity) {
+    problem = "truncated";
+  } else if ((map_flags & FLEXA_MAP_VERIFY) && !fresh &&
+             header->checksum != flexa_checksum(header, base + sizeof(*header),
+                                                header->size * item_size)) {
+    problem = "failing its checksum";
+  }
+  if (problem) {
+    munmap(base, length);
+    close(fd);
+    QWISTYS_ERROR_MSG("%s is %s", path, problem);
+    QWISTYS_TELEMETRY_END();
+    return NULL;
+  }
+  header->capacity = capacity;
+
+  const qwistys_allocator_t *allocator = qwistys_allocator_default();
+  flexa_t *array = (flexa_t*)allocator->alloc(allocator->context, sizeof(flexa_t));
+  if (!array) {
+    munmap(base, length);
+    close(fd);
+    QWISTYS_HALT("Memory allocation failed during initialization");
+    return NULL;
+  }
+  array->item_size = item_size;
+  array->capacity = capacity;
+  array->size = (size_t)header->size;
+  array->data = base + sizeof(flexa_file_header_t);
+  array->allocator = allocator;
+  array->growth = &flexa_default_growth;
+  array->kind = FLEXA_BACKING_MAPPED;
+  array->reserve_flags = 0;
+  array->backing.fd = fd;
+
+  QWISTYS_DEBUG_MSG("Mapped %zu items from %s", array->size, path);
   QWISTYS_TELEMETRY_END();
 
   return array;
 }
 
+int flexa_sync(flexa_t *array) {
+  QWISTYS_ASSERT(array != NULL);
+  if (array->kind != FLEXA_BACKING_MAPPED) {
+    QWISTYS_DEBUG_MSG("Array is not mapped");
+    return -1;
+  }
+
+  QWISTYS_TELEMETRY_START();
+
+  flexa_file_header_t *header = flexa_file_header(array);
+  header->size = array->size;
+  header->capacity = array->capacity;
+  header->checksum = flexa_checksum(header, array->data, array->size * array->item_size);
+  int result = msync(header, flexa_file_length(array->item_size, array->capacity), MS_SYNC);
+  if (result != 0) {
+    QWISTYS_ERROR_MSG("Failed to sync mapped array");
+    result = -1;
+  }
+
+  QWISTYS_TELEMETRY_END();
+  return result;
+}
+
+void flexa_set_growth(flexa_t *array, flexa_growth_t growth) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(growth.factor > 1.0 || growth.increment > 0);
+
+  if (array->growth == &flexa_default_growth) {
+    flexa_growth_t *own = (flexa_growth_t *)array->allocator->alloc(
+        array->allocator->context, sizeof(flexa_growth_t));
+    if (!own) {
+      QWISTYS_HALT("Memory allocation failed for growth policy");
+      return;
+    }
+    array->growth = own;
+  }
+  *(flexa_growth_t *)array->growth = growth;
+}
+
 void flexa_free(flexa_t *array) {
   QWISTYS_ASSERT(array != NULL);
 
@@ -53,8 +487,19 @@ void flexa_free(flexa_t *array) {
   QWISTYS_TELEMETRY_START();
 
   if (array) {
-    free(array->data);
-    free(array);
+    const qwistys_allocator_t *allocator = array->allocator;
+    if (array->kind == FLEXA_BACKING_RESERVED) {
+      munmap(array->data, array->backing.reserved);
+      flexa_release_growth(array);
+    } else if (array->kind == FLEXA_BACKING_MAPPED) {
+      flexa_sync(array);
+      munmap(flexa_file_header(array), flexa_file_length(array->item_size, array->capacity));
+      close(array->backing.fd);
+      flexa_release_growth(array);
+    } else {
+      flexa_deinit(array);
+    }
+    allocator->free(allocator->context, array);
   }
 
   QWISTYS_DEBUG_MSG("Array freed successfully");
@@ -68,7 +513,7 @@ int flexa_add(flexa_t *array, const void *item) {
   QWISTYS_TELEMETRY_START();
 
   if (array->size >= array->capacity) {
-    if (flexa_resize(array, array->capacity * 2) != 0) {
+    if (flexa_grow(array, array->size + 1) != 0) {
       return -1;
     }
   }
@@ -121,4 +566,1408 @@ int flexa_remove(flexa_t *array, size_t index) {
 void *flexa_get_raw_data(flexa_t *array) {
   QWISTYS_ASSERT(array != NULL);
   return array->data;
-}
\ No newline at end of file
+}
+
+int flexa_add_n(flexa_t *array, const void *items, size_t count) {
+  return flexa_insert_range(array, flexa_size(array), items, count);
+}
+
+int flexa_insert_range(flexa_t *array, size_t index, const void *items,
+                       size_t count) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(items != NULL || count == 0);
+  QWISTYS_BOUNDS_CHECK(index, array->size + 1);
+
+  QWISTYS_TELEMETRY_START();
+
+  if (count > SIZE_MAX - array->size || flexa_grow(array, array->size + count) != 0) {
+    QWISTYS_TELEMETRY_END();
+    return -1;
+  }
+
+  char *destination = (char *)array->data + (index * array->item_size);
+  size_t bytes = count * array->item_size;
+  memmove(destination + bytes, destination,
+          (array->size - index) * array->item_size);
+  memcpy(destination, items, bytes);
+  array->size += count;
+
+  QWISTYS_DEBUG_MSG("Inserted %zu items to array", count);
+  QWISTYS_TELEMETRY_END();
+
+  return 0;
+}
+
+int flexa_remove_range(flexa_t *array, size_t index, size_t count) {
+  QWISTYS_ASSERT(array != NULL);
+  if (index > array->size || count > array->size - index) {
+    QWISTYS_DEBUG_MSG("Range %zu+%zu is out of bounds", index, count);
+    return -1;
+  }
+
+  QWISTYS_TELEMETRY_START();
+
+  char *destination = (char *)array->data + (index * array->item_size);
+  size_t bytes = count * array->item_size;
+  memmove(destination, destination + bytes,
+          (array->size - index - count) * array->item_size);
+  array->size -= count;
+
+  QWISTYS_DEBUG_MSG("Removed %zu items from array", count);
+  QWISTYS_TELEMETRY_END();
+
+  return 0;
+}
+
+int flexa_reserve(flexa_t *array, size_t capacity) {
+  QWISTYS_ASSERT(array != NULL);
+  if (capacity <= array->capacity) {
+    return 0;
+  }
+  if (array->kind == FLEXA_BACKING_RESERVED &&
+      capacity > array->backing.reserved / array->item_size) {
+    QWISTYS_DEBUG_MSG("Capacity %zu is above the reservation", capacity);
+    return -1;
+  }
+  return flexa_resize(array, capacity);
+}
+
+int flexa_resize_to(flexa_t *array, size_t size) {
+  QWISTYS_ASSERT(array != NULL);
+
+  QWISTYS_TELEMETRY_START();
+
+  if (flexa_grow(array, size) != 0) {
+    QWISTYS_TELEMETRY_END();
+    return -1;
+  }
+  if (size > array->size) {
+    memset((char *)array->data + (array->size * array->item_size), 0,
+           (size - array->size) * array->item_size);
+  }
+  array->size = size;
+
+  QWISTYS_TELEMETRY_END();
+
+  return 0;
+}
+
+int flexa_shrink_to_fit(flexa_t *array) {
+  QWISTYS_ASSERT(array != NULL);
+  // Keeps room for one item, a flexa never has zero capacity
+  size_t capacity = array->size ? array->size : 1;
+  if (capacity == array->capacity) {
+    return 0;
+  }
+  return flexa_resize(array, capacity);
+}
+
+int flexa_swap_remove(flexa_t *array, size_t index) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_BOUNDS_CHECK(index, array->size);
+
+  size_t last = array->size - 1;
+  if (index != last) {
+    memcpy((char *)array->data + (index * array->item_size),
+           (char *)array->data + (last * array->item_size), array->item_size);
+  }
+  array->size--;
+
+  return 0;
+}
+
+size_t flexa_remove_if(flexa_t *array, int (*pred)(const void *, void *),
+                       void *ctx) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(pred != NULL);
+
+  QWISTYS_TELEMETRY_START();
+
+  // Kept items move down in runs, each run with one memmove
+  char *data = (char *)array->data;
+  size_t item_size = array->item_size;
+  size_t write = 0;
+  size_t run_start = 0;
+  for (size_t read = 0; read < array->size; read++) {
+    if (pred(data + (read * item_size), ctx)) {
+      if (write != run_start) {
+        memmove(data + (write * item_size), data + (run_start * item_size),
+                (read - run_start) * item_size);
+      }
+      write += read - run_start;
+      run_start = read + 1;
+    }
+  }
+  if (write != run_start) {
+    memmove(data + (write * item_size), data + (run_start * item_size),
+            (array->size - run_start) * item_size);
+  }
+  write += array->size - run_start;
+
+  size_t removed = array->size - write;
+  array->size = write;
+
+  QWISTYS_DEBUG_MSG("Removed %zu items from array", removed);
+  QWISTYS_TELEMETRY_END();
+
+  return removed;
+}
+
+// ================================================
+// Sorting and searching
+// ================================================
+
+#define FLEXA_SORT_INSERTION 16        // Runs this short are insertion sorted
+#define FLEXA_SORT_PARALLEL_MIN 65536  // Fewer items are sorted on the calling thread
+
+// Copies one item, the common sizes become plain moves
+static inline void flexa_copy_item(char *destination, const char *source,
+                                   size_t item_size) {
+  switch (item_size) {
+  case 4: memcpy(destination, source, 4); break;
+  case 8: memcpy(destination, source, 8); break;
+  case 16: memcpy(destination, source, 16); break;
+  default: memcpy(destination, source, item_size); break;
+  }
+}
+
+// Maps a key to an unsigned integer with the same order
+static inline uint64_t flexa_radix_key(const char *item, size_t key_offset,
+                                       flexa_key_t key_type) {
+  switch (key_type) {
+  case FLEXA_KEY_U32: {
+    uint32_t key;
+    memcpy(&key, item + key_offset, sizeof(key));
+    return key;
+  }
+  case FLEXA_KEY_I32: {
+    uint32_t key;
+    memcpy(&key, item + key_offset, sizeof(key));
+    return key ^ 0x80000000u;
+  }
+  case FLEXA_KEY_F32: {
+    uint32_t key;
+    memcpy(&key, item + key_offset, sizeof(key));
+    return (key & 0x80000000u) ? ~key : key ^ 0x80000000u;
+  }
+  case FLEXA_KEY_U64: {
+    uint64_t key;
+    memcpy(&key, item + key_offset, sizeof(key));
+    return key;
+  }
+  case FLEXA_KEY_I64: {
+    uint64_t key;
+    memcpy(&key, item + key_offset, sizeof(key));
+    return key ^ 0x8000000000000000ull;
+  }
+  case FLEXA_KEY_F64:
+  default: {
+    uint64_t key;
+    memcpy(&key, item + key_offset, sizeof(key));
+    return (key & 0x8000000000000000ull) ? ~key : key ^ 0x8000000000000000ull;
+  }
+  }
+}
+
+int flexa_radix_sort(flexa_t *array, size_t key_offset, flexa_key_t key_type) {
+  QWISTYS_ASSERT(array != NULL);
+  size_t key_size = (key_type == FLEXA_KEY_U32 || key_type == FLEXA_KEY_I32 ||
+                     key_type == FLEXA_KEY_F32) ? 4 : 8;
+  QWISTYS_ASSERT(key_offset + key_size <= array->item_size);
+
+  size_t count = array->size;
+  size_t item_size = array->item_size;
+  if (count < 2) {
+    return 0;
+  }
+
+  QWISTYS_TELEMETRY_START();
+
+  const qwistys_allocator_t *allocator = array->allocator;
+  char *buffer = (char *)allocator->alloc(allocator->context, count * item_size);
+  if (!buffer) {
+    QWISTYS_DEBUG_MSG("No memory for the radix sort buffer");
+    QWISTYS_TELEMETRY_END();
+    return -1;
+  }
+
+  // Histograms of all digits in one pass over the keys
+  size_t histogram[8][256];
+  memset(histogram, 0, sizeof(histogram));
+  char *source = (char *)array->data;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t key = flexa_radix_key(source + (i * item_size), key_offset, key_type);
+    for (size_t digit = 0; digit < key_size; digit++) {
+      histogram[digit][(key >> (digit * 8)) & 0xFF]++;
+    }
+  }
+
+  char *destination = buffer;
+  for (size_t digit = 0; digit < key_size; digit++) {
+    size_t *counts = histogram[digit];
+    size_t shift = digit * 8;
+    // All keys share this digit, the pass would not move anything
+    if (counts[(flexa_radix_key(source, key_offset, key_type) >> shift) & 0xFF] == count) {
+      continue;
+    }
+    size_t offset = 0;
+    for (size_t bucket = 0; bucket < 256; bucket++) {
+      size_t bucket_count = counts[bucket];
+      counts[bucket] = offset;
+      offset += bucket_count;
+    }
+    for (size_t i = 0; i < count; i++) {
+      const char *item = source + (i * item_size);
+      size_t bucket = (flexa_radix_key(item, key_offset, key_type) >> shift) & 0xFF;
+      flexa_copy_item(destination + (counts[bucket]++ * item_size), item, item_size);
+    }
+    char *swap = source;
+    source = destination;
+    destination = swap;
+  }
+  if (source != (char *)array->data) {
+    memcpy(array->data, source, count * item_size);
+  }
+
+  allocator->free(allocator->context, buffer);
+  QWISTYS_TELEMETRY_END();
+  return 0;
+}
+
+typedef struct {
+  char *data;   // Items being sorted
+  char *buffer; // Scratch of the same size
+  size_t item_size;
+  int (*cmp)(const void *, const void *);
+} flexa_sorter_t;
+
+// Stable merge of the sorted runs [begin, middle) and [middle, end) into destination
+static void flexa_merge(const flexa_sorter_t *sorter, const char *source,
+                        char *destination, size_t begin, size_t middle,
+                        size_t end) {
+  size_t item_size = sorter->item_size;
+  size_t left = begin;
+  size_t right = middle;
+  char *out = destination + (begin * item_size);
+  while (left < middle && right < end) {
+    const char *a = source + (left * item_size);
+    const char *b = source + (right * item_size);
+    if (sorter->cmp(b, a) < 0) {
+      flexa_copy_item(out, b, item_size);
+      right++;
+    } else {
+      flexa_copy_item(out, a, item_size);
+      left++;
+    }
+    out += item_size;
+  }
+  memcpy(out, source + (left * item_size), (middle - left) * item_size);
+  out += (middle - left) * item_size;
+  memcpy(out, source + (right * item_size), (end - right) * item_size);
+}
+
+// Sorts [begin, end) of data stably, buffer is scratch
+static void flexa_merge_sort(const flexa_sorter_t *sorter, size_t begin,
+                             size_t end) {
+  size_t item_size = sorter->item_size;
+  if (end - begin <= FLEXA_SORT_INSERTION) {
+    char *data = sorter->data;
+    char *item = sorter->buffer + (begin * item_size);
+    for (size_t i = begin + 1; i < end; i++) {
+      flexa_copy_item(item, data + (i * item_size), item_size);
+      size_t j = i;
+      while (j > begin && sorter->cmp(item, data + ((j - 1) * item_size)) < 0) {
+        flexa_copy_item(data + (j * item_size), data + ((j - 1) * item_size), item_size);
+        j--;
+      }
+      flexa_copy_item(data + (j * item_size), item, item_size);
+    }
+    return;
+  }
+  size_t middle = begin + (end - begin) / 2;
+  flexa_merge_sort(sorter, begin, middle);
+  flexa_merge_sort(sorter, middle, end);
+  // Already in order, nothing to merge
+  if (sorter->cmp(sorter->data + (middle * item_size),
+                  sorter->data + ((middle - 1) * item_size)) >= 0) {
+    return;
+  }
+  flexa_merge(sorter, sorter->data, sorter->buffer, begin, middle, end);
+  memcpy(sorter->data + (begin * item_size), sorter->buffer + (begin * item_size),
+         (end - begin) * item_size);
+}
+
+typedef struct {
+  const flexa_sorter_t *sorter;
+  const char *source;
+  char *destination;
+  size_t begin;
+  size_t middle; // begin == middle asks for a sort of [middle, end)
+  size_t end;
+} flexa_sort_job_t;
+
+static void *flexa_sort_worker(void *arg) {
+  flexa_sort_job_t *job = (flexa_sort_job_t *)arg;
+  if (job->begin == job->middle) {
+    flexa_merge_sort(job->sorter, job->middle, job->end);
+  } else {
+    flexa_merge(job->sorter, job->source, job->destination, job->begin,
+                job->middle, job->end);
+  }
+  return NULL;
+}
+
+// Runs the jobs on threads, the last one on the calling thread
+static void flexa_sort_run(flexa_sort_job_t *jobs, pthread_t *workers,
+                           size_t count) {
+  size_t started = 0;
+  for (; started + 1 < count; started++) {
+    if (pthread_create(&workers[started], NULL, flexa_sort_worker, &jobs[started]) != 0) {
+      break;
+    }
+  }
+  for (size_t i = started; i < count; i++) {
+    flexa_sort_worker(&jobs[i]);
+  }
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+}
+
+int flexa_sort(flexa_t *array, int (*cmp)(const void *, const void *),
+               size_t threads) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(cmp != NULL);
+
+  size_t count = array->size;
+  size_t item_size = array->item_size;
+  if (count < 2) {
+    return 0;
+  }
+
+  QWISTYS_TELEMETRY_START();
+
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (size_t)online : 1;
+  }
+  threads = QWISTYS_MIN(threads, QWISTYS_MAX(count / FLEXA_SORT_PARALLEL_MIN, (size_t)1));
+
+  const qwistys_allocator_t *allocator = array->allocator;
+  char *buffer = (char *)allocator->alloc(allocator->context, count * item_size);
+  flexa_sort_job_t *jobs = (flexa_sort_job_t *)allocator->alloc(
+      allocator->context,
+      threads * (sizeof(flexa_sort_job_t) + sizeof(pthread_t) + sizeof(size_t)) +
+          sizeof(size_t));
+  if (!buffer || !jobs) {
+    if (buffer) {
+      allocator->free(allocator->context, buffer);
+    }
+    if (jobs) {
+      allocator->free(allocator->context, jobs);
+    }
+    QWISTYS_DEBUG_MSG("No memory for the merge sort buffer");
+    QWISTYS_TELEMETRY_END();
+    return -1;
+  }
+  pthread_t *workers = (pthread_t *)(jobs + threads);
+  size_t *bounds = (size_t *)(workers + threads); // Run i is [bounds[i], bounds[i + 1])
+
+  flexa_sorter_t sorter = {(char *)array->data, buffer, item_size, cmp};
+
+  // Every thread sorts a slice, then pairs of runs are merged in parallel
+  // rounds, bouncing between the array and the buffer
+  size_t runs = threads;
+  for (size_t i = 0; i <= runs; i++) {
+    bounds[i] = count * i / runs;
+  }
+  for (size_t i = 0; i < runs; i++) {
+    flexa_sort_job_t job = {&sorter, NULL, NULL, bounds[i], bounds[i], bounds[i + 1]};
+    jobs[i] = job;
+  }
+  flexa_sort_run(jobs, workers, runs);
+
+  char *source = sorter.data;
+  char *destination = buffer;
+  while (runs > 1) {
+    size_t merges = 0;
+    for (size_t i = 0; i + 1 < runs; i += 2) {
+      flexa_sort_job_t job = {&sorter, source, destination, bounds[i],
+                              bounds[i + 1], bounds[i + 2]};
+      jobs[merges++] = job;
+    }
+    if (runs % 2) {
+      // The odd run out is carried over as it is
+      size_t last = bounds[runs - 1];
+      memcpy(destination + (last * item_size), source + (last * item_size),
+             (count - last) * item_size);
+    }
+    flexa_sort_run(jobs, workers, merges);
+    for (size_t i = 0; i < runs; i += 2) {
+      bounds[i / 2] = bounds[i];
+    }
+    runs = (runs + 1) / 2;
+    bounds[runs] = count;
+    char *swap = source;
+    source = destination;
+    destination = swap;
+  }
+  if (source != sorter.data) {
+    memcpy(sorter.data, source, count * item_size);
+  }
+
+  allocator->free(allocator->context, jobs);
+  allocator->free(allocator->context, buffer);
+  QWISTYS_TELEMETRY_END();
+  return 0;
+}
+
+size_t flexa_lower_bound(flexa_t *array, const void *key,
+                         int (*cmp)(const void *, const void *)) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(cmp != NULL);
+
+  const char *data = (const char *)array->data;
+  size_t low = 0;
+  size_t high = array->size;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (cmp(key, data + (middle * array->item_size)) > 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+void *flexa_bsearch(flexa_t *array, const void *key,
+                    int (*cmp)(const void *, const void *)) {
+  size_t index = flexa_lower_bound(array, key, cmp);
+  if (index == array->size) {
+    return NULL;
+  }
+  void *item = (char *)array->data + (index * array->item_size);
+  return cmp(key, item) == 0 ? item : NULL;
+}
+
+// ================================================
+// Vector kernels
+// ================================================
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define FLEXA_SIMD_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*flexa_scan_fn)(const void *data, size_t count, const void *value);
+typedef size_t (*flexa_filter_fn)(const void *data, size_t count, flexa_op_t op,
+                                  const void *value, void *out);
+typedef void (*flexa_reduce_fn)(const void *data, size_t count, void *result);
+
+// One instruction set, every table is indexed by flexa_key_t
+typedef struct {
+  flexa_scan_fn find[6];     // Index of the first equal item or count
+  flexa_scan_fn count[6];    // Number of equal items
+  flexa_filter_fn filter[6]; // Copies the matching items to out, returns how many
+  flexa_reduce_fn sum[6];
+  flexa_reduce_fn min[6];    // count > 0
+  flexa_reduce_fn max[6];    // count > 0
+} flexa_kernels_t;
+
+#define FLEXA_MATCH(a, op, b)                                                  \
+  ((op) == FLEXA_EQ   ? (a) == (b)                                             \
+   : (op) == FLEXA_NE ? (a) != (b)                                             \
+   : (op) == FLEXA_LT ? (a) < (b)                                              \
+   : (op) == FLEXA_LE ? (a) <= (b)                                             \
+   : (op) == FLEXA_GT ? (a) > (b)                                              \
+                      : (a) >= (b))
+
+// Plain loops, the fallback and the tails of the vector kernels
+#define FLEXA_SCALAR_KERNELS(name, T, ACC)                                     \
+  static size_t flexa_find_##name##_scalar(const void *data, size_t count,     \
+                                           const void *value) {                \
+    const T *items = (const T *)data;                                          \
+    T key;                                                                     \
+    memcpy(&key, value, sizeof(key));                                          \
+    for (size_t i = 0; i < count; i++) {                                       \
+      if (items[i] == key) {                                                   \
+        return i;                                                              \
+      }                                                                        \
+    }                                                                          \
+    return count;                                                              \
+  }                                                                            \
+                                                                               \
+  static size_t flexa_count_##name##_scalar(const void *data, size_t count,    \
+                                            const void *value) {               \
+    const T *items = (const T *)data;                                          \
+    T key;                                                                     \
+    memcpy(&key, value, sizeof(key));                                          \
+    size_t matches = 0;                                                        \
+    for (size_t i = 0; i < count; i++) {                                       \
+      matches += items[i] == key;                                              \
+    }                                                                          \
+    return matches;                                                            \
+  }                                                                            \
+                                                                               \
+  static size_t flexa_filter_##name##_scalar(const void *data, size_t count,   \
+                                             flexa_op_t op, const void *value, \
+                                             void *out) {                      \
+    const T *items = (const T *)data;                                          \
+    T *kept = (T *)out;                                                        \
+    T key;                                                                     \
+    memcpy(&key, value, sizeof(key));                                          \
+    size_t matches = 0;                                                        \
+    for (size_t i = 0; i < count; i++) {                                       \
+      if (FLEXA_MATCH(items[i], op, key)) {                                    \
+        kept[matches++] = items[i];                                            \
+      }                                                                        \
+    }                                                                          \
+    return matches;                                                            \
+  }                                                                            \
+                                                                               \
+  static void flexa_sum_##name##_scalar(const void *data, size_t count,        \
+                                        void *result) {                        \
+    const T *items = (const T *)data;                                          \
+    ACC sum = 0;                                                               \
+    for (size_t i = 0; i < count; i++) {                                       \
+      sum += items[i];                                                         \
+    }                                                                          \
+    memcpy(result, &sum, sizeof(sum));                                         \
+  }                                                                            \
+                                                                               \
+  static void flexa_min_##name##_scalar(const void *data, size_t count,        \
+                                        void *result) {                        \
+    const T *items = (const T *)data;                                          \
+    T best = items[0];                                                         \
+    for (size_t i = 1; i < count; i++) {                                       \
+      if (items[i] < best) {                                                   \
+        best = items[i];                                                       \
+      }                                                                        \
+    }                                                                          \
+    memcpy(result, &best, sizeof(best));                                       \
+  }                                                                            \
+                                                                               \
+  static void flexa_max_##name##_scalar(const void *data, size_t count,        \
+                                        void *result) {                        \
+    const T *items = (const T *)data;                                          \
+    T best = items[0];                                                         \
+    for (size_t i = 1; i < count; i++) {                                       \
+      if (items[i] > best) {                                                   \
+        best = items[i];                                                       \
+      }                                                                        \
+    }                                                                          \
+    memcpy(result, &best, sizeof(best));                                       \
+  }
+
+FLEXA_SCALAR_KERNELS(u32, uint32_t, uint64_t)
+FLEXA_SCALAR_KERNELS(i32, int32_t, int64_t)
+FLEXA_SCALAR_KERNELS(f32, float, double)
+FLEXA_SCALAR_KERNELS(u64, uint64_t, uint64_t)
+FLEXA_SCALAR_KERNELS(i64, int64_t, int64_t)
+FLEXA_SCALAR_KERNELS(f64, double, double)
+
+#define FLEXA_KERNEL_ROW(kernel, isa)                                          \
+  {flexa_##kernel##_u32_##isa, flexa_##kernel##_i32_##isa,                     \
+   flexa_##kernel##_f32_##isa, flexa_##kernel##_u64_##isa,                     \
+   flexa_##kernel##_i64_##isa, flexa_##kernel##_f64_##isa}
+
+#define FLEXA_KERNEL_TABLE(isa)                                                \
+  {FLEXA_KERNEL_ROW(find, isa),   FLEXA_KERNEL_ROW(count, isa),                \
+   FLEXA_KERNEL_ROW(filter, isa), FLEXA_KERNEL_ROW(sum, isa),                  \
+   FLEXA_KERNEL_ROW(min, isa),    FLEXA_KERNEL_ROW(max, isa)}
+
+static const flexa_kernels_t flexa_scalar_kernels = FLEXA_KERNEL_TABLE(scalar);
+
+#ifdef FLEXA_SIMD_X86
+
+// Lane masks of a vector comparison as bits, one per lane
+#define FLEXA_BITS32_sse2(m) ((unsigned)_mm_movemask_ps((__m128)(m)))
+#define FLEXA_BITS64_sse2(m) ((unsigned)_mm_movemask_pd((__m128d)(m)))
+#define FLEXA_BITS32_avx2(m) ((unsigned)_mm256_movemask_ps((__m256)(m)))
+#define FLEXA_BITS64_avx2(m) ((unsigned)_mm256_movemask_pd((__m256d)(m)))
+#define FLEXA_BITS32_avx512(m)                                                 \
+  ((unsigned)_mm512_test_epi32_mask((__m512i)(m), (__m512i)(m)))
+#define FLEXA_BITS64_avx512(m)                                                 \
+  ((unsigned)_mm512_test_epi64_mask((__m512i)(m), (__m512i)(m)))
+
+// Adds the vector at items + i to the sum lanes, items as wide as the sum
+#define FLEXA_ADD_SAME(isa, name, T, width)                                    \
+  flexa_##name##_##isa##_v v;                                                  \
+  memcpy(&v, items + i, sizeof(v));                                            \
+  total += (flexa_##name##_##isa##_acc)v;
+
+// Same for items half as wide, each half of the vector is widened
+#define FLEXA_ADD_WIDE(isa, name, T, width)                                    \
+  flexa_##name##_##isa##_half low;                                             \
+  flexa_##name##_##isa##_half high;                                            \
+  memcpy(&low, items + i, sizeof(low));                                        \
+  memcpy(&high, items + i + lanes / 2, sizeof(high));                          \
+  total += __builtin_convertvector(low, flexa_##name##_##isa##_acc) +          \
+           __builtin_convertvector(high, flexa_##name##_##isa##_acc);
+
+// The kernels of one type on one instruction set, written with GCC vector
+// extensions so a single body serves every vector width
+#define FLEXA_VECTOR_KERNELS(isa, features, width, name, T, UT, ACC, BITS,     \
+                             ACCUMULATE)                                       \
+  typedef T flexa_##name##_##isa##_v __attribute__((vector_size(width)));      \
+  typedef UT flexa_##name##_##isa##_u __attribute__((vector_size(width)));     \
+  typedef ACC flexa_##name##_##isa##_acc __attribute__((vector_size(width)));  \
+  typedef T flexa_##name##_##isa##_half __attribute__((vector_size(width / 2))); \
+                                                                               \
+  __attribute__((target(features))) static size_t flexa_find_##name##_##isa(   \
+      const void *data, size_t count, const void *value) {                     \
+    const T *items = (const T *)data;                                          \
+    size_t lanes = width / sizeof(T);                                          \
+    T scalar;                                                                  \
+    memcpy(&scalar, value, sizeof(scalar));                                    \
+    flexa_##name##_##isa##_v key = (flexa_##name##_##isa##_v){0} + scalar;     \
+    size_t i = 0;                                                              \
+    for (; i + lanes <= count; i += lanes) {                                   \
+      flexa_##name##_##isa##_v v;                                              \
+      memcpy(&v, items + i, sizeof(v));                                        \
+      unsigned bits = BITS(v == key);                                          \
+      if (bits) {                                                              \
+        return i + (size_t)__builtin_ctz(bits);                                \
+      }                                                                        \
+    }                                                                          \
+    return i + flexa_find_##name##_scalar(items + i, count - i, value);        \
+  }                                                                            \
+                                                                               \
+  __attribute__((target(features))) static size_t flexa_count_##name##_##isa(  \
+      const void *data, size_t count, const void *value) {                     \
+    const T *items = (const T *)data;                                          \
+    size_t lanes = width / sizeof(T);                                          \
+    T scalar;                                                                  \
+    memcpy(&scalar, value, sizeof(scalar));                                    \
+    flexa_##name##_##isa##_v key = (flexa_##name##_##isa##_v){0} + scalar;     \
+    size_t matches = 0;                                                        \
+    size_t i = 0;                                                              \
+    size_t end = count - (count % lanes);                                      \
+    while (i < end) {                                                          \
+      /* Lane counters take the -1 of every hit, flushed before they wrap */   \
+      flexa_##name##_##isa##_u hits = {0};                                     \
+      size_t limit = QWISTYS_MIN(end, i + (((size_t)1 << 30) * lanes));        \
+      for (; i < limit; i += lanes) {                                          \
+        flexa_##name##_##isa##_v v;                                            \
+        memcpy(&v, items + i, sizeof(v));                                      \
+        hits -= (flexa_##name##_##isa##_u)(v == key);                          \
+      }                                                                        \
+      for (size_t lane = 0; lane < lanes; lane++) {                            \
+        matches += (size_t)hits[lane];                                         \
+      }                                                                        \
+    }                                                                          \
+    return matches + flexa_count_##name##_scalar(items + i, count - i, value); \
+  }                                                                            \
+                                                                               \
+  __attribute__((target(features))) static size_t flexa_filter_##name##_##isa( \
+      const void *data, size_t count, flexa_op_t op, const void *value,        \
+      void *out) {                                                             \
+    const T *items = (const T *)data;                                          \
+    T *kept = (T *)out;                                                        \
+    size_t lanes = width / sizeof(T);                                          \
+    T scalar;                                                                  \
+    memcpy(&scalar, value, sizeof(scalar));                                    \
+    flexa_##name##_##isa##_v key = (flexa_##name##_##isa##_v){0} + scalar;     \
+    size_t matches = 0;                                                        \
+    size_t i = 0;                                                              \
+    for (; i + lanes <= count; i += lanes) {                                   \
+      flexa_##name##_##isa##_v v;                                              \
+      memcpy(&v, items + i, sizeof(v));                                        \
+      __typeof__(v == key) mask;                                               \
+      switch (op) {                                                            \
+      case FLEXA_EQ: mask = v == key; break;                                   \
+      case FLEXA_NE: mask = v != key; break;                                   \
+      case FLEXA_LT: mask = v < key; break;                                    \
+      case FLEXA_LE: mask = v <= key; break;                                   \
+      case FLEXA_GT: mask = v > key; break;                                    \
+      default: mask = v >= key; break;                                         \
+      }                                                                        \
+      for (unsigned bits = BITS(mask); bits; bits &= bits - 1) {               \
+        kept[matches++] = items[i + (size_t)__builtin_ctz(bits)];              \
+      }                                                                        \
+    }                                                                          \
+    return matches + flexa_filter_##name##_scalar(items + i, count - i, op,    \
+                                                  value, kept + matches);      \
+  }                                                                            \
+                                                                               \
+  __attribute__((target(features))) static void flexa_sum_##name##_##isa(      \
+      const void *data, size_t count, void *result) {                          \
+    const T *items = (const T *)data;                                          \
+    size_t lanes = width / sizeof(T);                                          \
+    flexa_##name##_##isa##_acc total = {0};                                    \
+    size_t i = 0;                                                              \
+    for (; i + lanes <= count; i += lanes) {                                   \
+      ACCUMULATE(isa, name, T, width)                                          \
+    }                                                                          \
+    ACC sum;                                                                   \
+    flexa_sum_##name##_scalar(items + i, count - i, &sum);                     \
+    for (size_t lane = 0; lane < sizeof(total) / sizeof(ACC); lane++) {        \
+      sum += total[lane];                                                      \
+    }                                                                          \
+    memcpy(result, &sum, sizeof(sum));                                         \
+  }                                                                            \
+                                                                               \
+  FLEXA_VECTOR_PICK(isa, features, width, name, T, min, <)                     \
+  FLEXA_VECTOR_PICK(isa, features, width, name, T, max, >)
+
+// Lane wise min or max, the blend goes through the unsigned view
+#define FLEXA_VECTOR_PICK(isa, features, width, name, T, kernel, cmp)          \
+  __attribute__((target(features))) static void flexa_##kernel##_##name##_##isa( \
+      const void *data, size_t count, void *result) {                          \
+    const T *items = (const T *)data;                                          \
+    size_t lanes = width / sizeof(T);                                          \
+    if (count < lanes) {                                                       \
+      flexa_##kernel##_##name##_scalar(data, count, result);                   \
+      return;                                                                  \
+    }                                                                          \
+    flexa_##name##_##isa##_v best;                                             \
+    memcpy(&best, items, sizeof(best));                                        \
+    size_t i = lanes;                                                          \
+    for (; i + lanes <= count; i += lanes) {                                   \
+      flexa_##name##_##isa##_v v;                                              \
+      memcpy(&v, items + i, sizeof(v));                                        \
+      flexa_##name##_##isa##_u take = (flexa_##name##_##isa##_u)(v cmp best);  \
+      best = (flexa_##name##_##isa##_v)(                                       \
+          ((flexa_##name##_##isa##_u)v & take) |                               \
+          ((flexa_##name##_##isa##_u)best & ~take));                           \
+    }                                                                          \
+    T pick = best[0];                                                          \
+    for (size_t lane = 1; lane < lanes; lane++) {                              \
+      if (best[lane] cmp pick) {                                               \
+        pick = best[lane];                                                     \
+      }                                                                        \
+    }                                                                          \
+    for (; i < count; i++) {                                                   \
+      if (items[i] cmp pick) {                                                 \
+        pick = items[i];                                                       \
+      }                                                                        \
+    }                                                                          \
+    memcpy(result, &pick, sizeof(pick));                                       \
+  }
+
+#define FLEXA_VECTOR_ISA(isa, features, width)                                 \
+  FLEXA_VECTOR_KERNELS(isa, features, width, u32, uint32_t, uint32_t, uint64_t, \
+                       FLEXA_BITS32_##isa, FLEXA_ADD_WIDE)                     \
+  FLEXA_VECTOR_KERNELS(isa, features, width, i32, int32_t, uint32_t, int64_t,  \
+                       FLEXA_BITS32_##isa, FLEXA_ADD_WIDE)                     \
+  FLEXA_VECTOR_KERNELS(isa, features, width, f32, float, uint32_t, double,     \
+                       FLEXA_BITS32_##isa, FLEXA_ADD_WIDE)                     \
+  FLEXA_VECTOR_KERNELS(isa, features, width, u64, uint64_t, uint64_t, uint64_t, \
+                       FLEXA_BITS64_##isa, FLEXA_ADD_SAME)                     \
+  FLEXA_VECTOR_KERNELS(isa, features, width, i64, int64_t, uint64_t, int64_t,  \
+                       FLEXA_BITS64_##isa, FLEXA_ADD_SAME)                     \
+  FLEXA_VECTOR_KERNELS(isa, features, width, f64, double, uint64_t, double,    \
+                       FLEXA_BITS64_##isa, FLEXA_ADD_SAME)                     \
+  static const flexa_kernels_t flexa_##isa##_kernels = FLEXA_KERNEL_TABLE(isa);
+
+FLEXA_VECTOR_ISA(sse2, "sse2", 16)
+FLEXA_VECTOR_ISA(avx2, "avx2,popcnt", 32)
+FLEXA_VECTOR_ISA(avx512, "avx512f,popcnt", 64)
+
+#endif // FLEXA_SIMD_X86
+
+static const flexa_kernels_t *flexa_kernels_active = NULL;
+static flexa_simd_t flexa_simd_active = FLEXA_SIMD_SCALAR;
+
+static int flexa_simd_supported(flexa_simd_t level) {
+  switch (level) {
+  case FLEXA_SIMD_SCALAR:
+    return 1;
+#ifdef FLEXA_SIMD_X86
+  case FLEXA_SIMD_SSE2:
+    return 1;
+  case FLEXA_SIMD_AVX2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  case FLEXA_SIMD_AVX512:
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt");
+#endif
+  default:
+    return 0;
+  }
+}
+
+int flexa_simd_set_level(flexa_simd_t level) {
+  if (!flexa_simd_supported(level)) {
+    QWISTYS_DEBUG_MSG("SIMD level %d is not supported", (int)level);
+    return -1;
+  }
+  const flexa_kernels_t *kernels = &flexa_scalar_kernels;
+#ifdef FLEXA_SIMD_X86
+  if (level == FLEXA_SIMD_SSE2) {
+    kernels = &flexa_sse2_kernels;
+  } else if (level == FLEXA_SIMD_AVX2) {
+    kernels = &flexa_avx2_kernels;
+  } else if (level == FLEXA_SIMD_AVX512) {
+    kernels = &flexa_avx512_kernels;
+  }
+#endif
+  __atomic_store_n(&flexa_simd_active, level, __ATOMIC_RELAXED);
+  __atomic_store_n(&flexa_kernels_active, kernels, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Picks the widest supported set on first use
+static const flexa_kernels_t *flexa_kernels(void) {
+  const flexa_kernels_t *kernels = __atomic_load_n(&flexa_kernels_active, __ATOMIC_ACQUIRE);
+  if (__builtin_expect(kernels == NULL, 0)) {
+    flexa_simd_t level = FLEXA_SIMD_AVX512;
+    while (!flexa_simd_supported(level)) {
+      level = (flexa_simd_t)(level - 1);
+    }
+    flexa_simd_set_level(level);
+    kernels = __atomic_load_n(&flexa_kernels_active, __ATOMIC_ACQUIRE);
+  }
+  return kernels;
+}
+
+flexa_simd_t flexa_simd_level(void) {
+  flexa_kernels();
+  return __atomic_load_n(&flexa_simd_active, __ATOMIC_RELAXED);
+}
+
+// Size of the items a typed kernel works on
+static size_t flexa_key_size(flexa_key_t type) {
+  return (type == FLEXA_KEY_U32 || type == FLEXA_KEY_I32 || type == FLEXA_KEY_F32) ? 4 : 8;
+}
+
+size_t flexa_find_u32(flexa_t *array, uint32_t value) {
+  QWISTYS_ASSERT(array != NULL && array->item_size == sizeof(value));
+  return flexa_kernels()->find[FLEXA_KEY_U32](array->data, array->size, &value);
+}
+
+size_t flexa_find_u64(flexa_t *array, uint64_t value) {
+  QWISTYS_ASSERT(array != NULL && array->item_size == sizeof(value));
+  return flexa_kernels()->find[FLEXA_KEY_U64](array->data, array->size, &value);
+}
+
+size_t flexa_find_f32(flexa_t *array, float value) {
+  QWISTYS_ASSERT(array != NULL && array->item_size == sizeof(value));
+  return flexa_kernels()->find[FLEXA_KEY_F32](array->data, array->size, &value);
+}
+
+size_t flexa_find_f64(flexa_t *array, double value) {
+  QWISTYS_ASSERT(array != NULL && array->item_size == sizeof(value));
+  return flexa_kernels()->find[FLEXA_KEY_F64](array->data, array->size, &value);
+}
+
+size_t flexa_count_eq(flexa_t *array, const void *value) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(value != NULL);
+
+  // Items are compared as raw bits, 4 and 8 byte items take the vector path
+  if (array->item_size == 4) {
+    return flexa_kernels()->count[FLEXA_KEY_U32](array->data, array->size, value);
+  }
+  if (array->item_size == 8) {
+    return flexa_kernels()->count[FLEXA_KEY_U64](array->data, array->size, value);
+  }
+  size_t matches = 0;
+  const char *item = (const char *)array->data;
+  for (size_t i = 0; i < array->size; i++, item += array->item_size) {
+    matches += memcmp(item, value, array->item_size) == 0;
+  }
+  return matches;
+}
+
+int flexa_filter_into(flexa_t *destination, flexa_t *source, flexa_key_t type,
+                      flexa_op_t op, const void *value) {
+  QWISTYS_ASSERT(destination != NULL && source != NULL && destination != source);
+  QWISTYS_ASSERT(value != NULL);
+  QWISTYS_ASSERT(source->item_size == flexa_key_size(type));
+  QWISTYS_ASSERT(destination->item_size == source->item_size);
+
+  QWISTYS_TELEMETRY_START();
+
+  // Room for the worst case, the kernel writes straight into the array
+  if (flexa_grow(destination, destination->size + source->size) != 0) {
+    QWISTYS_TELEMETRY_END();
+    return -1;
+  }
+  void *out = (char *)destination->data + (destination->size * destination->item_size);
+  destination->size += flexa_kernels()->filter[type](source->data, source->size, op, value, out);
+
+  QWISTYS_TELEMETRY_END();
+  return 0;
+}
+
+int flexa_sum(flexa_t *array, flexa_key_t type, void *result) {
+  QWISTYS_ASSERT(array != NULL && result != NULL);
+  QWISTYS_ASSERT(array->item_size == flexa_key_size(type));
+  flexa_kernels()->sum[type](array->data, array->size, result);
+  return 0;
+}
+
+int flexa_min(flexa_t *array, flexa_key_t type, void *result) {
+  QWISTYS_ASSERT(array != NULL && result != NULL);
+  QWISTYS_ASSERT(array->item_size == flexa_key_size(type));
+  if (array->size == 0) {
+    return -1;
+  }
+  flexa_kernels()->min[type](array->data, array->size, result);
+  return 0;
+}
+
+int flexa_max(flexa_t *array, flexa_key_t type, void *result) {
+  QWISTYS_ASSERT(array != NULL && result != NULL);
+  QWISTYS_ASSERT(array->item_size == flexa_key_size(type));
+  if (array->size == 0) {
+    return -1;
+  }
+  flexa_kernels()->max[type](array->data, array->size, result);
+  return 0;
+}
+
+// ================================================
+// Segmented array
+// ================================================
+
+// With base = 1 << base_shift, chunk k covers indexes [base * (2^k - 1),
+// base * (2^(k+1) - 1)). Shifting the index by base makes the chunk the
+// position of the highest set bit and the offset the bits below it.
+static inline unsigned flexa_chunk_of(size_t index, unsigned base_shift, size_t *offset) {
+  size_t shifted = index + ((size_t)1 << base_shift);
+  unsigned high_bit = (unsigned)(63 - __builtin_clzll((unsigned long long)shifted));
+  *offset = shifted - ((size_t)1 << high_bit);
+  return high_bit - base_shift;
+}
+
+static inline void *flexa_seg_locate(const flexa_seg_t *seg, size_t index) {
+  size_t offset;
+  unsigned chunk = flexa_chunk_of(index, seg->base_shift, &offset);
+  return (char *)seg->chunks[chunk] + (offset * seg->item_size);
+}
+
+static inline size_t flexa_seg_chunk_items(const flexa_seg_t *seg, unsigned chunk) {
+  return (size_t)1 << (seg->base_shift + chunk);
+}
+
+flexa_seg_t *flexa_seg_init(size_t item_size, size_t first_chunk) {
+  return flexa_seg_init_ex(item_size, first_chunk, NULL);
+}
+
+flexa_seg_t *flexa_seg_init_ex(size_t item_size, size_t first_chunk,
+                               const qwistys_allocator_t *allocator) {
+  QWISTYS_ASSERT(item_size > 0);
+  QWISTYS_ASSERT(first_chunk > 0);
+
+  if (!allocator) {
+    allocator = qwistys_allocator_default();
+  }
+
+  flexa_seg_t *seg = (flexa_seg_t *)allocator->alloc(allocator->context, sizeof(flexa_seg_t));
+  if (!seg) {
+    QWISTYS_HALT("Memory allocation failed during initialization");
+    return NULL;
+  }
+  memset(seg, 0, sizeof(*seg));
+  seg->item_size = item_size;
+  seg->allocator = allocator;
+  while (((size_t)1 << seg->base_shift) < first_chunk) {
+    seg->base_shift++;
+  }
+
+  QWISTYS_DEBUG_MSG("Segmented array initialized, first chunk %zu items",
+                    flexa_seg_chunk_items(seg, 0));
+  return seg;
+}
+
+void flexa_seg_free(flexa_seg_t *seg) {
+  QWISTYS_ASSERT(seg != NULL);
+
+  const qwistys_allocator_t *allocator = seg->allocator;
+  for (unsigned i = 0; i < seg->chunk_count; i++) {
+    allocator->free(allocator->context, seg->chunks[i]);
+  }
+  allocator->free(allocator->context, seg);
+}
+
+int flexa_seg_add(flexa_seg_t *seg, const void *item) {
+  QWISTYS_ASSERT(seg != NULL);
+  QWISTYS_ASSERT(item != NULL);
+
+  QWISTYS_TELEMETRY_START();
+
+  if (seg->size == seg->capacity) {
+    unsigned chunk = seg->chunk_count;
+    if (chunk == FLEXA_SEG_MAX_CHUNKS) {
+      QWISTYS_ERROR_MSG("Segmented array is full");
+      QWISTYS_TELEMETRY_END();
+      return -1;
+    }
+    size_t items = flexa_seg_chunk_items(seg, chunk);
+    void *data = seg->allocator->alloc(seg->allocator->context, items * seg->item_size);
+    if (!data) {
+      QWISTYS_HALT("Memory allocation failed during resize");
+      return -1;
+    }
+    seg->chunks[chunk] = data;
+    seg->chunk_count++;
+    seg->capacity += items;
+  }
+
+  memcpy(flexa_seg_locate(seg, seg->size), item, seg->item_size);
+  seg->size++;
+
+  QWISTYS_TELEMETRY_END();
+  return 0;
+}
+
+void *flexa_seg_get(flexa_seg_t *seg, size_t index) {
+  QWISTYS_ASSERT(seg != NULL);
+  QWISTYS_BOUNDS_CHECK(index, seg->size);
+  return flexa_seg_locate(seg, index);
+}
+
+int flexa_seg_pop(flexa_seg_t *seg, void *out) {
+  QWISTYS_ASSERT(seg != NULL);
+  if (seg->size == 0) {
+    return -1;
+  }
+  seg->size--;
+  if (out) {
+    memcpy(out, flexa_seg_locate(seg, seg->size), seg->item_size);
+  }
+  return 0;
+}
+
+size_t flexa_seg_size(flexa_seg_t *seg) {
+  QWISTYS_ASSERT(seg != NULL);
+  return seg->size;
+}
+
+void flexa_seg_iter_init(flexa_seg_iter_t *iter, const flexa_seg_t *seg) {
+  QWISTYS_ASSERT(iter != NULL && seg != NULL);
+  iter->seg = seg;
+  iter->index = 0;
+  iter->chunk = 0;
+}
+
+void *flexa_seg_next(flexa_seg_iter_t *iter, size_t *count) {
+  QWISTYS_ASSERT(iter != NULL && count != NULL);
+  const flexa_seg_t *seg = iter->seg;
+  if (iter->index >= seg->size) {
+    *count = 0;
+    return NULL;
+  }
+  size_t items = flexa_seg_chunk_items(seg, iter->chunk);
+  *count = QWISTYS_MIN(items, seg->size - iter->index);
+  void *run = seg->chunks[iter->chunk];
+  iter->index += *count;
+  iter->chunk++;
+  return run;
+}
+
+// ================================================
+// Multi-producer append
+// ================================================
+
+// A chunk holds its items followed by one ready byte per item. Producers
+// set the byte after writing the item; whoever finds the byte at the
+// watermark set moves the watermark on, so no producer waits for another.
+
+static inline size_t flexa_mp_chunk_bytes(const flexa_mp_t *array, unsigned chunk) {
+  size_t items = (size_t)1 << (array->base_shift + chunk);
+  return items * (array->item_size + 1);
+}
+
+static inline unsigned char *flexa_mp_ready(const flexa_mp_t *array, char *chunk_data,
+                                            unsigned chunk, size_t offset) {
+  size_t items = (size_t)1 << (array->base_shift + chunk);
+  return (unsigned char *)chunk_data + (items * array->item_size) + offset;
+}
+
+// Chunk of a reserved slot, allocated by the first producer to need it
+static char *flexa_mp_chunk(flexa_mp_t *array, unsigned chunk) {
+  char *data = __atomic_load_n(&array->chunks[chunk], __ATOMIC_ACQUIRE);
+  if (data) {
+    return data;
+  }
+  const qwistys_allocator_t *allocator = array->allocator;
+  size_t bytes = flexa_mp_chunk_bytes(array, chunk);
+  char *fresh = (char *)allocator->alloc(allocator->context, bytes);
+  if (!fresh) {
+    QWISTYS_HALT("Memory allocation failed during resize");
+    return NULL;
+  }
+  memset(flexa_mp_ready(array, fresh, chunk, 0), 0, bytes / (array->item_size + 1));
+  if (!__atomic_compare_exchange_n(&array->chunks[chunk], &data, fresh, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    // Another producer installed it first
+    allocator->free(allocator->context, fresh);
+    return data;
+  }
+  return fresh;
+}
+
+static void flexa_mp_advance(flexa_mp_t *array) {
+  size_t mark = __atomic_load_n(&array->published, __ATOMIC_SEQ_CST);
+  for (;;) {
+    // Scan the ready run from the watermark, then claim it with one CAS.
+    // The reservation of next, the ready stores and the loads of both here
+    // are all sequentially consistent: of two producers finishing
+    // neighbouring slots i and i + 1, either the one of i sees next past
+    // i + 1 or the one of i + 1 sees ready[i], so one of them publishes both.
+    size_t end = mark;
+    size_t next = __atomic_load_n(&array->next, __ATOMIC_SEQ_CST);
+    while (end < next) {
+      size_t offset;
+      unsigned chunk = flexa_chunk_of(end, array->base_shift, &offset);
+      if (chunk >= FLEXA_SEG_MAX_CHUNKS) {
+        break;
+      }
+      char *data = __atomic_load_n(&array->chunks[chunk], __ATOMIC_ACQUIRE);
+      if (!data ||
+          !__atomic_load_n(flexa_mp_ready(array, data, chunk, offset), __ATOMIC_SEQ_CST)) {
+        break;
+      }
+      end++;
+    }
+    if (end == mark) {
+      return;
+    }
+    // On failure mark is reloaded, another thread moved the watermark
+    if (__atomic_compare_exchange_n(&array->published, &mark, end, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      mark = end;
+    } else if (mark >= end) {
+      return;
+    }
+  }
+}
+
+flexa_mp_t *flexa_mp_init(size_t item_size, size_t first_chunk) {
+  return flexa_mp_init_ex(item_size, first_chunk, NULL);
+}
+
+flexa_mp_t *flexa_mp_init_ex(size_t item_size, size_t first_chunk,
+                             const qwistys_allocator_t *allocator) {
+  QWISTYS_ASSERT(item_size > 0);
+  QWISTYS_ASSERT(first_chunk > 0);
+
+  if (!allocator) {
+    allocator = qwistys_allocator_default();
+  }
+
+  // next and published are cache line aligned, the struct has to be as well
+  flexa_mp_t *array = (flexa_mp_t *)qwistys_aligned_alloc(QWISTYS_CACHE_LINE, sizeof(flexa_mp_t), NULL);
+  if (!array) {
+    QWISTYS_HALT("Memory allocation failed during initialization");
+    return NULL;
+  }
+  memset(array, 0, sizeof(*array));
+  array->item_size = item_size;
+  array->allocator = allocator;
+  while (((size_t)1 << array->base_shift) < first_chunk) {
+    array->base_shift++;
+  }
+  return array;
+}
+
+void flexa_mp_free(flexa_mp_t *array) {
+  QWISTYS_ASSERT(array != NULL);
+
+  const qwistys_allocator_t *allocator = array->allocator;
+  for (unsigned i = 0; i < FLEXA_SEG_MAX_CHUNKS; i++) {
+    if (array->chunks[i]) {
+      allocator->free(allocator->context, array->chunks[i]);
+    }
+  }
+  qwistys_aligned_free(array);
+}
+
+int flexa_mp_add(flexa_mp_t *array, const void *item) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_ASSERT(item != NULL);
+
+  // A full array is refused before reserving. Producers racing for the
+  // last slots may still reserve past the end, those slots have no chunk
+  // and no slot after them can be published, so the watermark loses nothing.
+  size_t offset;
+  size_t index = __atomic_load_n(&array->next, __ATOMIC_RELAXED);
+  if (flexa_chunk_of(index, array->base_shift, &offset) >= FLEXA_SEG_MAX_CHUNKS) {
+    QWISTYS_ERROR_MSG("Multi-producer array is full");
+    return -1;
+  }
+  index = __atomic_fetch_add(&array->next, 1, __ATOMIC_SEQ_CST);
+  unsigned chunk = flexa_chunk_of(index, array->base_shift, &offset);
+  if (chunk >= FLEXA_SEG_MAX_CHUNKS) {
+    QWISTYS_ERROR_MSG("Multi-producer array is full");
+    return -1;
+  }
+  // A failed chunk allocation halts, the slot is never left half reserved
+  char *data = flexa_mp_chunk(array, chunk);
+  if (!data) {
+    return -1;
+  }
+
+  memcpy(data + (offset * array->item_size), item, array->item_size);
+  __atomic_store_n(flexa_mp_ready(array, data, chunk, offset), 1, __ATOMIC_SEQ_CST);
+  flexa_mp_advance(array);
+  return 0;
+}
+
+size_t flexa_mp_published(flexa_mp_t *array) {
+  QWISTYS_ASSERT(array != NULL);
+  return __atomic_load_n(&array->published, __ATOMIC_ACQUIRE);
+}
+
+void *flexa_mp_get(flexa_mp_t *array, size_t index) {
+  QWISTYS_ASSERT(array != NULL);
+  QWISTYS_BOUNDS_CHECK(index, flexa_mp_published(array));
+  size_t offset;
+  unsigned chunk = flexa_chunk_of(index, array->base_shift, &offset);
+  char *data = __atomic_load_n(&array->chunks[chunk], __ATOMIC_ACQUIRE);
+  return data + (offset * array->item_size);
+}
+
+// ================================================
+// Struct of arrays
+// ================================================
+
+static int flexa_soa_resize(flexa_soa_t *soa, size_t new_capacity) {
+  const qwistys_allocator_t *allocator = soa->allocator;
+  for (size_t i = 0; i < soa->field_count; i++) {
+    size_t field_size = soa->field_sizes[i];
+    char *column = (char *)allocator->realloc(allocator->context, soa->columns[i],
+                                              soa->capacity * field_size,
+                                              new_capacity * field_size);
+    if (!column) {
+      QWISTYS_HALT("Memory allocation failed during resize");
+      return -1;
+    }
+    soa->columns[i] = column;
+  }
+  soa->capacity = new_capacity;
+  return 0;
+}
+
+flexa_soa_t *flexa_soa_init(const size_t *field_sizes, size_t field_count,
+                            size_t initial_capacity) {
+  return flexa_soa_init_ex(field_sizes, field_count, initial_capacity, NULL);
+}
+
+flexa_soa_t *flexa_soa_init_ex(const size_t *field_sizes, size_t field_count,
+                               size_t initial_capacity,
+                               const qwistys_allocator_t *allocator) {
+  QWISTYS_ASSERT(field_sizes != NULL);
+  QWISTYS_ASSERT(field_count > 0);
+  QWISTYS_ASSERT(initial_capacity > 0);
+
+  QWISTYS_TELEMETRY_START();
+
+  if (!allocator) {
+    allocator = qwistys_allocator_default();
+  }
+
+  // Struct, column pointers and field sizes in one block
+  size_t bytes = sizeof(flexa_soa_t) + (field_count * (sizeof(char *) + sizeof(size_t)));
+  flexa_soa_t *soa = (flexa_soa_t *)allocator->alloc(allocator->context, bytes);
+  if (!soa) {
+    QWISTYS_HALT("Memory allocation failed during initialization");
+    return NULL;
+  }
+  soa->columns = (char **)(soa + 1);
+  size_t *sizes = (size_t *)(soa->columns + field_count);
+  memcpy(sizes, field_sizes, field_count * sizeof(size_t));
+  soa->field_sizes = sizes;
+  soa->field_count = field_count;
+  soa->size = 0;
+  soa->capacity = initial_capacity;
+  soa->allocator = allocator;
+
+  for (size_t i = 0; i < field_count; i++) {
+    QWISTYS_ASSERT(field_sizes[i] > 0);
+    soa->columns[i] = (char *)allocator->alloc(allocator->context,
+                                               initial_capacity * field_sizes[i]);
+    if (!soa->columns[i]) {
+      while (i--) {
+        allocator->free(allocator->context, soa->columns[i]);
+      }
+      allocator->free(allocator->context, soa);
+      QWISTYS_HALT("Memory allocation failed during data initialization");
+      return NULL;
+    }
+  }
+
+  QWISTYS_DEBUG_MSG("Struct of arrays initialized with %zu fields", field_count);
+  QWISTYS_TELEMETRY_END();
+
+  return soa;
+}
+
+void flexa_soa_free(flexa_soa_t *soa) {
+  QWISTYS_ASSERT(soa != NULL);
+
+  const qwistys_allocator_t *allocator = soa->allocator;
+  for (size_t i = 0; i < soa->field_count; i++) {
+    allocator->free(allocator->context, soa->columns[i]);
+  }
+  allocator->free(allocator->context, soa);
+}
+
+int flexa_soa_add(flexa_soa_t *soa, const void *const *fields) {
+  QWISTYS_ASSERT(soa != NULL);
+  QWISTYS_ASSERT(fields != NULL);
+
+  QWISTYS_TELEMETRY_START();
+
+  if (soa->size == soa->capacity && flexa_soa_resize(soa, soa->capacity * 2) != 0) {
+    return -1;
+  }
+  for (size_t i = 0; i < soa->field_count; i++) {
+    size_t field_size = soa->field_sizes[i];
+    memcpy(soa->columns[i] + (soa->size * field_size), fields[i], field_size);
+  }
+  soa->size++;
+
+  QWISTYS_TELEMETRY_END();
+  return 0;
+}
+
+void flexa_soa_get_row(flexa_soa_t *soa, size_t index, void *const *fields) {
+  QWISTYS_ASSERT(soa != NULL);
+  QWISTYS_ASSERT(fields != NULL);
+  QWISTYS_BOUNDS_CHECK(index, soa->size);
+
+  for (size_t i = 0; i < soa->field_count; i++) {
+    if (fields[i]) {
+      size_t field_size = soa->field_sizes[i];
+      memcpy(fields[i], soa->columns[i] + (index * field_size), field_size);
+    }
+  }
+}
+
+void *flexa_soa_at(flexa_soa_t *soa, size_t field, size_t index) {
+  QWISTYS_ASSERT(soa != NULL);
+  QWISTYS_BOUNDS_CHECK(field, soa->field_count);
+  QWISTYS_BOUNDS_CHECK(index, soa->size);
+  return soa->columns[field] + (index * soa->field_sizes[field]);
+}
+
+int flexa_soa_swap_remove(flexa_soa_t *soa, size_t index) {
+  QWISTYS_ASSERT(soa != NULL);
+  QWISTYS_BOUNDS_CHECK(index, soa->size);
+
+  size_t last = soa->size - 1;
+  if (index != last) {
+    for (size_t i = 0; i < soa->field_count; i++) {
+      size_t field_size = soa->field_sizes[i];
+      memcpy(soa->columns[i] + (index * field_size), soa->columns[i] + (last * field_size),
+             field_size);
+    }
+  }
+  soa->size--;
+  return 0;
+}
+
+void *flexa_soa_column(flexa_soa_t *soa, size_t field) {
+  QWISTYS_ASSERT(soa != NULL);
+  QWISTYS_BOUNDS_CHECK(field, soa->field_count);
+  return soa->columns[field];
+}
+
+size_t flexa_soa_size(flexa_soa_t *soa) {
+  QWISTYS_ASSERT(soa != NULL);
+  return soa->size;
+}
@@ -6,18 +6,84 @@ extern "C" {
 #endif
 
 #include "qwistys_macros.h"
+#include "qwistys_alloc.h"
 #include "string.h"
 
 // ================================================
 // Dynamic Array
 // ================================================
 
+// How capacity grows when an add does not fit
+typedef struct {
+  double factor;       // Capacity multiplier, 2.0 by default
+  size_t increment;    // Items added per step past linear_after, or always if factor <= 1
+  size_t linear_after; // Capacity where growth turns linear, 0 for never
+} flexa_growth_t;
+
+// Key types flexa_radix_sort understands
+typedef enum {
+  FLEXA_KEY_U32,
+  FLEXA_KEY_I32,
+  FLEXA_KEY_F32,
+  FLEXA_KEY_U64,
+  FLEXA_KEY_I64,
+  FLEXA_KEY_F64
+} flexa_key_t;
+
+// Comparisons flexa_filter_into keeps items by, item op value
+typedef enum {
+  FLEXA_EQ,
+  FLEXA_NE,
+  FLEXA_LT,
+  FLEXA_LE,
+  FLEXA_GT,
+  FLEXA_GE
+} flexa_op_t;
+
+// Instruction sets of the vector kernels
+typedef enum {
+  FLEXA_SIMD_SCALAR,
+  FLEXA_SIMD_SSE2,
+  FLEXA_SIMD_AVX2,
+  FLEXA_SIMD_AVX512
+} flexa_simd_t;
+
+// flexa_init_reserved flags
+#define FLEXA_RESERVE_HUGE_PAGES 0x1 // Commit in 2 MiB steps and ask for transparent huge pages
+
+// flexa_open_mapped flags
+#define FLEXA_MAP_CREATE 0x1   // Create the file if it does not exist
+#define FLEXA_MAP_TRUNCATE 0x2 // Start from an empty array
+#define FLEXA_MAP_VERIFY 0x4   // Check the items against the checksum, reads the whole file
+
+// Where the items of a flexa_t live
+#define FLEXA_BACKING_HEAP 0     // The allocator, or the caller buffer of an inline array
+#define FLEXA_BACKING_RESERVED 1 // A flexa_init_reserved address range
+#define FLEXA_BACKING_MAPPED 2   // A flexa_open_mapped file
+
 typedef struct {
   size_t item_size; // Size of each item
   size_t capacity;  // Allocated memory in number of items
   size_t size;      // Number of items currently in the array
   void *data;       // Pointer to the data
-} flexa_t;
+  const qwistys_allocator_t *allocator; // Source of the struct and the data
+  const flexa_growth_t *growth; // Shared default until flexa_set_growth
+  uint16_t kind;          // FLEXA_BACKING_*, picks the live member of backing
+  uint16_t reserve_flags; // FLEXA_RESERVE_* of a reserved array
+  union {
+    void *buffer;    // HEAP: caller storage of an inline array, NULL otherwise
+    size_t reserved; // RESERVED: bytes of address space behind data
+    int fd;          // MAPPED: file behind the array
+  } backing;
+} flexa_t; // 64 bytes, one cache line
+
+// An array with room for N items inside it, spills to the heap past that.
+// The array points into itself, do not copy or move it once initialized.
+#define FLEXA_INLINE(T, N)                                                     \
+  struct {                                                                     \
+    flexa_t array;                                                             \
+    T items[N];                                                                \
+  }
 
 /**
  * @brief Initialize thh dinamic array
@@ -27,6 +93,72 @@ typedef struct {
  */
 flexa_t *flexa_init(size_t item_size, size_t initial_capacity);
 
+/**
+ * @brief Initialize the dinamic array on a given allocator
+ * @param allocator memory source of the array, NULL for
+ * qwistys_allocator_default(), must outlive the array
+ * @return pointer to structure of the flexa or NULL in case of failed
+ */
+flexa_t *flexa_init_ex(size_t item_size, size_t initial_capacity,
+                       const qwistys_allocator_t *allocator);
+
+/**
+ * @brief Initialize an array on a reserved range of address space
+ * @note pages are committed as the array grows, data never moves and
+ * pointers into it stay valid. Adding past max_items fails with -1.
+ * @param max_items the most items the array can ever hold
+ * @param reserve_flags FLEXA_RESERVE_* or 0
+ * @return pointer to structure of the flexa or NULL in case of failed
+ */
+flexa_t *flexa_init_reserved(size_t item_size, size_t max_items,
+                             int reserve_flags);
+
+/**
+ * @brief Initialize an array in caller memory, e.g. a struct member
+ * @note no allocation while the items fit in buffer. Release it with
+ * flexa_deinit, not flexa_free.
+ * @code
+ * FLEXA_INLINE(int, 8) small;
+ * flexa_init_inline(&small.array, sizeof(int), small.items, 8, NULL);
+ * @endcode
+ * @param buffer storage for the first capacity items, NULL to allocate them
+ * @param allocator source of the items past the buffer, NULL for the default
+ * @return 0 on success -1 on fail
+ */
+int flexa_init_inline(flexa_t *array, size_t item_size, void *buffer,
+                      size_t capacity, const qwistys_allocator_t *allocator);
+
+/**
+ * @brief Release the items of an array set up by flexa_init_inline
+ */
+void flexa_deinit(flexa_t *array);
+
+/**
+ * @brief Open an array stored in a file, mapped without deserialization
+ * @note the file holds a 64 byte header (item_size, size, capacity,
+ * checksum) and the items. Growth extends the file and remaps it, so
+ * the data can move. The size on disk is updated by flexa_sync and
+ * flexa_free, a crash keeps the size of the last sync.
+ * @param map_flags FLEXA_MAP_* or 0
+ * @return pointer to structure of the flexa or NULL in case of failed
+ */
+flexa_t *flexa_open_mapped(const char *path, size_t item_size, int map_flags);
+
+/**
+ * @brief Write size and checksum to the header and flush a mapped array to disk
+ * @note reads all items to compute the checksum
+ * @return 0 on success -1 on fail or if the array is not mapped
+ */
+int flexa_sync(flexa_t *array);
+
+/**
+ * @brief Change how the array grows
+ * @note the policy is copied to the allocator of the array, the first
+ * call on an array allocates. e.g. {1.5, 0, 0} for less slack, {2.0, 1 << 20, 1 << 24} to double
+ * up to 16M items and add 1M at a time after that
+ */
+void flexa_set_growth(flexa_t *array, flexa_growth_t growth);
+
 /**
  * @brief Release the mem of the flexa
  */
@@ -64,6 +196,152 @@ size_t flexa_size(flexa_t *array);
  */
 int flexa_remove(flexa_t *array, size_t index);
 
+/**
+ * @brief Remove an item in O(1) by moving the last item into its place
+ * @note does not keep the order of the items
+ * @return int 0 on success -1 on fail
+ */
+int flexa_swap_remove(flexa_t *array, size_t index);
+
+/**
+ * @brief Remove every item pred returns non zero for, in one linear pass
+ * @note keeps the order of the remaining items
+ * @param pred called once per item with ctx, must not change the array
+ * @return number of removed items
+ */
+size_t flexa_remove_if(flexa_t *array, int (*pred)(const void *, void *),
+                       void *ctx);
+
+/**
+ * @brief Append count items with one capacity check and one copy
+ * @param items count items laid out back to back
+ * @return 0 on success -1 on fail
+ */
+int flexa_add_n(flexa_t *array, const void *items, size_t count);
+
+/**
+ * @brief Insert count items before index, index == size appends
+ * @note the tail moves once, whatever count is
+ * @return 0 on success -1 on fail
+ */
+int flexa_insert_range(flexa_t *array, size_t index, const void *items,
+                       size_t count);
+
+/**
+ * @brief Remove count items starting at index with a single memmove
+ * @return 0 on success -1 if the range is not inside the array
+ */
+int flexa_remove_range(flexa_t *array, size_t index, size_t count);
+
+/**
+ * @brief Make room for at least capacity items, the size does not change
+ * @return 0 on success -1 on fail
+ */
+int flexa_reserve(flexa_t *array, size_t capacity);
+
+/**
+ * @brief Set the number of items, new items are zeroed
+ * @return 0 on success -1 on fail
+ */
+int flexa_resize_to(flexa_t *array, size_t size);
+
+/**
+ * @brief Give back the capacity above the current size
+ * @return 0 on success -1 on fail
+ */
+int flexa_shrink_to_fit(flexa_t *array);
+
+/**
+ * @brief Stable LSD radix sort by a numeric key inside each item
+ * @param key_offset byte offset of the key in the item
+ * @param key_type FLEXA_KEY_*, floats sort by value with -0 before +0
+ * and NaNs at the ends
+ * @note byte digits, passes where all keys share the digit are skipped.
+ * Takes a scratch copy of the array from its allocator.
+ * @return 0 on success -1 on fail
+ */
+int flexa_radix_sort(flexa_t *array, size_t key_offset, flexa_key_t key_type);
+
+/**
+ * @brief Stable merge sort, slices sorted and merged on several threads
+ * @param cmp qsort style comparator
+ * @param threads number of threads, 0 for one per online CPU. Each thread
+ * gets at least 64K items.
+ * @return 0 on success -1 on fail
+ */
+int flexa_sort(flexa_t *array, int (*cmp)(const void *, const void *),
+               size_t threads);
+
+/**
+ * @brief Index of the first item not less than key in a sorted array
+ * @param cmp called as cmp(key, item)
+ * @return index in [0, size]
+ */
+size_t flexa_lower_bound(flexa_t *array, const void *key,
+                         int (*cmp)(const void *, const void *));
+
+/**
+ * @brief Find an item equal to key in a sorted array
+ * @param cmp called as cmp(key, item)
+ * @return pointer to the first equal item or NULL
+ */
+void *flexa_bsearch(flexa_t *array, const void *key,
+                    int (*cmp)(const void *, const void *));
+
+/**
+ * @brief Index of the first item equal to value in an array of that type
+ * @note vector kernels on the raw data, see flexa_simd_level
+ * @return index of the item or the array size if there is none
+ */
+size_t flexa_find_u32(flexa_t *array, uint32_t value);
+size_t flexa_find_u64(flexa_t *array, uint64_t value);
+size_t flexa_find_f32(flexa_t *array, float value);
+size_t flexa_find_f64(flexa_t *array, double value);
+
+/**
+ * @brief Number of items whose bytes equal value
+ * @note 4 and 8 byte items are compared with vector kernels
+ */
+size_t flexa_count_eq(flexa_t *array, const void *value);
+
+/**
+ * @brief Append the items of source for which item op value holds
+ * @param type what the items of both arrays are, item_size must match it
+ * @param value pointer to a value of that type
+ * @return 0 on success -1 on fail
+ */
+int flexa_filter_into(flexa_t *destination, flexa_t *source, flexa_key_t type,
+                      flexa_op_t op, const void *value);
+
+/**
+ * @brief Sum of an array of type items
+ * @param result uint64_t for U32/U64 (wraps), int64_t for I32/I64,
+ * double for F32/F64. Float sums are added in vector lane order.
+ * @return 0 on success -1 on fail
+ */
+int flexa_sum(flexa_t *array, flexa_key_t type, void *result);
+
+/**
+ * @brief Smallest or biggest item of an array of type items
+ * @param result a value of the item type
+ * @note NaNs give an unspecified result
+ * @return 0 on success -1 if the array is empty
+ */
+int flexa_min(flexa_t *array, flexa_key_t type, void *result);
+int flexa_max(flexa_t *array, flexa_key_t type, void *result);
+
+/**
+ * @brief Instruction set the vector kernels run on
+ * @note the widest the CPU supports is picked on first use
+ */
+flexa_simd_t flexa_simd_level(void);
+
+/**
+ * @brief Force the vector kernels to an instruction set, e.g. for testing
+ * @return 0 on success -1 if the CPU or the build does not support it
+ */
+int flexa_simd_set_level(flexa_simd_t level);
+
 /**
  * @brief Getting access to raw array
  * @note to use in standart for/while loop for CPU caching
@@ -74,6 +352,293 @@ int flexa_remove(flexa_t *array, size_t index);
  */
 void *flexa_get_raw_data(flexa_t *array);
 
+// ================================================
+// Segmented Dynamic Array
+// ================================================
+
+#define FLEXA_SEG_MAX_CHUNKS 48
+
+// Chunk k holds first_chunk << k items, growth adds a chunk and never moves items
+typedef struct {
+  size_t item_size;
+  size_t size;
+  size_t capacity;      // Items in the allocated chunks
+  unsigned base_shift;  // log2 of the items in the first chunk
+  unsigned chunk_count;
+  const qwistys_allocator_t *allocator;
+  void *chunks[FLEXA_SEG_MAX_CHUNKS];
+} flexa_seg_t;
+
+typedef struct {
+  const flexa_seg_t *seg;
+  size_t index;
+  unsigned chunk;
+} flexa_seg_iter_t;
+
+/**
+ * @brief Initialize a segmented array, pointers to its items stay valid until freed
+ * @param first_chunk items in the first chunk, rounded up to a power of two
+ * @return pointer to structure of the array or NULL in case of failed
+ */
+flexa_seg_t *flexa_seg_init(size_t item_size, size_t first_chunk);
+
+/**
+ * @brief Initialize a segmented array on a given allocator
+ * @param allocator source of the struct and the chunks, NULL for the default
+ */
+flexa_seg_t *flexa_seg_init_ex(size_t item_size, size_t first_chunk,
+                               const qwistys_allocator_t *allocator);
+
+void flexa_seg_free(flexa_seg_t *seg);
+
+/**
+ * @brief Append an item, allocates a new chunk when the last one is full
+ * @return 0 on success -1 on fail
+ */
+int flexa_seg_add(flexa_seg_t *seg, const void *item);
+
+/**
+ * @brief Get an item in O(1), the chunk is found with a leading zero count
+ */
+void *flexa_seg_get(flexa_seg_t *seg, size_t index);
+
+/**
+ * @brief Remove the last item
+ * @param out receives a copy of the item, may be NULL
+ * @return 0 on success -1 if empty
+ */
+int flexa_seg_pop(flexa_seg_t *seg, void *out);
+
+size_t flexa_seg_size(flexa_seg_t *seg);
+
+/**
+ * @brief Start walking the array chunk by chunk
+ * @code
+ * flexa_seg_iter_t it;
+ * size_t count;
+ * flexa_seg_iter_init(&it, seg);
+ * for (int *items; (items = flexa_seg_next(&it, &count));) {
+ *   for (size_t i = 0; i < count; i++) { ... items[i] ... }
+ * }
+ * @endcode
+ */
+void flexa_seg_iter_init(flexa_seg_iter_t *iter, const flexa_seg_t *seg);
+
+/**
+ * @brief Next run of contiguous items
+ * @param count receives the number of items in the run
+ * @return first item of the run or NULL at the end
+ */
+void *flexa_seg_next(flexa_seg_iter_t *iter, size_t *count);
+
+// ================================================
+// Multi-producer Append
+// ================================================
+
+// Segmented array many threads append to without a lock. Items below
+// the published watermark are written and never move.
+typedef struct {
+  size_t item_size;
+  unsigned base_shift; // log2 of the items in the first chunk
+  const qwistys_allocator_t *allocator;
+  char *chunks[FLEXA_SEG_MAX_CHUNKS]; // Installed once with a CAS
+  size_t next __attribute__((aligned(QWISTYS_CACHE_LINE))); // Next free slot
+  size_t published __attribute__((aligned(QWISTYS_CACHE_LINE))); // Written prefix
+} flexa_mp_t;
+
+/**
+ * @brief Initialize a multi-producer array
+ * @param first_chunk items in the first chunk, rounded up to a power of two
+ * @return pointer to structure of the array or NULL in case of failed
+ */
+flexa_mp_t *flexa_mp_init(size_t item_size, size_t first_chunk);
+
+/**
+ * @brief Initialize a multi-producer array on a given allocator
+ * @note the allocator is called from the producer threads, it must be thread
+ * safe. It provides the chunks only, the struct is cache line aligned and
+ * comes from qwistys_aligned_alloc.
+ */
+flexa_mp_t *flexa_mp_init_ex(size_t item_size, size_t first_chunk,
+                             const qwistys_allocator_t *allocator);
+
+/**
+ * @brief Free the array, no producer or reader may still use it
+ */
+void flexa_mp_free(flexa_mp_t *array);
+
+/**
+ * @brief Append an item, safe from any number of threads
+ * @note the slot is reserved with an atomic fetch-add, a full chunk is
+ * followed by a new one, existing items are never moved. A full array is
+ * refused before a slot is reserved.
+ * @return 0 on success -1 on fail
+ */
+int flexa_mp_add(flexa_mp_t *array, const void *item);
+
+/**
+ * @brief Watermark below which every item is fully written
+ * @note items are published in index order, a slow producer holds back
+ * the watermark but not the other producers
+ */
+size_t flexa_mp_published(flexa_mp_t *array);
+
+/**
+ * @brief Get a published item, index must be below flexa_mp_published
+ */
+void *flexa_mp_get(flexa_mp_t *array, size_t index);
+
+// ================================================
+// Struct of Arrays
+// ================================================
+
+// Rows split into one contiguous column per field, a scan over one field
+// only reads that field
+typedef struct {
+  size_t field_count;
+  size_t size;
+  size_t capacity;
+  const size_t *field_sizes; // Copy kept after the struct
+  char **columns;            // One array of capacity items per field
+  const qwistys_allocator_t *allocator;
+} flexa_soa_t;
+
+/**
+ * @brief Initialize a struct of arrays
+ * @param field_sizes size in bytes of each field, copied
+ * @return pointer to structure of the array or NULL in case of failed
+ */
+flexa_soa_t *flexa_soa_init(const size_t *field_sizes, size_t field_count,
+                            size_t initial_capacity);
+
+/**
+ * @brief Initialize a struct of arrays on a given allocator
+ */
+flexa_soa_t *flexa_soa_init_ex(const size_t *field_sizes, size_t field_count,
+                               size_t initial_capacity,
+                               const qwistys_allocator_t *allocator);
+
+void flexa_soa_free(flexa_soa_t *soa);
+
+/**
+ * @brief Append a row
+ * @param fields one pointer per field to the value to copy
+ * @return 0 on success -1 on fail
+ */
+int flexa_soa_add(flexa_soa_t *soa, const void *const *fields);
+
+/**
+ * @brief Copy a row out
+ * @param fields one destination per field, NULL skips the field
+ */
+void flexa_soa_get_row(flexa_soa_t *soa, size_t index, void *const *fields);
+
+/**
+ * @brief Pointer to one field of one row
+ */
+void *flexa_soa_at(flexa_soa_t *soa, size_t field, size_t index);
+
+/**
+ * @brief Remove a row in O(1) by moving the last row into its place
+ * @return 0 on success -1 on fail
+ */
+int flexa_soa_swap_remove(flexa_soa_t *soa, size_t index);
+
+/**
+ * @brief Raw column of a field, valid until the next add
+ * @note cast it to the field type, flexa_soa_size items
+ */
+void *flexa_soa_column(flexa_soa_t *soa, size_t field);
+
+size_t flexa_soa_size(flexa_soa_t *soa);
+
+// ================================================
+// Typed Dynamic Array
+// ================================================
+
+/**
+ * @brief Generate a flexa specialized for T
+ * @note gives name_t and static inline name_init, name_free, name_push,
+ * name_at, name_pop and name_size. The item size is known at compile time,
+ * push and at are a plain store and load. Growth doubles and indexes are
+ * bounds checked like flexa_add/flexa_get.
+ * @code
+ * FLEXA_DEFINE(int_array, int)
+ * int_array_t numbers;
+ * int_array_init(&numbers, 16, NULL);
+ * int_array_push(&numbers, 42);
+ * @endcode
+ */
+#define FLEXA_DEFINE(name, T)                                                  \
+  typedef struct {                                                             \
+    T *data;                                                                   \
+    size_t size;                                                               \
+    size_t capacity;                                                           \
+    const qwistys_allocator_t *allocator;                                      \
+  } name##_t;                                                                  \
+                                                                               \
+  static inline int name##_init(name##_t *array, size_t initial_capacity,      \
+                                const qwistys_allocator_t *allocator) {        \
+    QWISTYS_ASSERT(array != NULL);                                             \
+    QWISTYS_ASSERT(initial_capacity > 0);                                      \
+    array->allocator = allocator ? allocator : qwistys_allocator_default();    \
+    array->size = 0;                                                           \
+    array->capacity = initial_capacity;                                        \
+    array->data = (T *)array->allocator->alloc(array->allocator->context,      \
+                                               initial_capacity * sizeof(T));  \
+    if (!array->data) {                                                        \
+      QWISTYS_HALT("Memory allocation failed during initialization");         \
+      return -1;                                                               \
+    }                                                                          \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name##_t *array) {                            \
+    QWISTYS_ASSERT(array != NULL);                                             \
+    array->allocator->free(array->allocator->context, array->data);            \
+    array->data = NULL;                                                        \
+    array->size = 0;                                                           \
+    array->capacity = 0;                                                       \
+  }                                                                            \
+                                                                               \
+  /* Kept out of line so push inlines to a compare and a store */              \
+  static __attribute__((noinline, unused)) int name##_grow(name##_t *array) {  \
+    size_t new_capacity = array->capacity * 2;                                 \
+    T *new_data = (T *)array->allocator->realloc(                              \
+        array->allocator->context, array->data, array->capacity * sizeof(T),   \
+        new_capacity * sizeof(T));                                             \
+    if (!new_data) {                                                           \
+      QWISTYS_HALT("Memory allocation failed during resize");                 \
+      return -1;                                                               \
+    }                                                                          \
+    array->data = new_data;                                                    \
+    array->capacity = new_capacity;                                            \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int name##_push(name##_t *array, T item) {                     \
+    if (__builtin_expect(array->size >= array->capacity, 0) &&                 \
+        name##_grow(array) != 0) {                                             \
+      return -1;                                                               \
+    }                                                                          \
+    array->data[array->size++] = item;                                         \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline T *name##_at(name##_t *array, size_t index) {                  \
+    QWISTYS_BOUNDS_CHECK(index, array->size);                                  \
+    return &array->data[index];                                                \
+  }                                                                            \
+                                                                               \
+  static inline T name##_pop(name##_t *array) {                                \
+    QWISTYS_BOUNDS_CHECK(array->size - 1, array->size);                        \
+    return array->data[--array->size];                                         \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_size(const name##_t *array) {                    \
+    return array->size;                                                        \
+  }
+
 #ifdef __cplusplus
 }
 #endif
@@ -111,6 +111,9 @@ static void (*qwistys_log)(qwistys_log_level_t level, const char *file,
 #define QWISTYS_MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define QWISTYS_MAX(a, b) (((a) > (b)) ? (a) : (b))
 
+// Keeps data written by different threads on separate cache lines
+#define QWISTYS_CACHE_LINE 64
+
 #define QWISTYS_TODO_ENABLE
 #ifdef QWISTYS_TODO_ENABLE
 #ifdef QWISTYS_TODO_FORCE
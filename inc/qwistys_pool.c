@@ -0,0 +1,399 @@
+#include "qwistys_pool.h"
+#include "qwistys_alloc.h"
+#include "qwistys_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Spins through the pool looking for work before a worker sleeps
+#define POOL_IDLE_SPINS 64
+// A sleeping worker wakes up at least this often, a missed signal costs no more
+#define POOL_SLEEP_NS 1000000
+
+typedef struct pool_task_t pool_task_t;
+
+// Every task is the same fixed size, copied into deque slots and the inject ring
+struct pool_task_t {
+    void (*run)(qwistys_pool_t *pool, pool_task_t *task);
+    qwistys_task_group_t *group;
+    qwistys_task_fn fn;
+    void *arg;
+    size_t begin;
+    size_t end;
+};
+
+#define POOL_TASK_WORDS (sizeof(pool_task_t) / sizeof(uintptr_t))
+
+// A thief may read a slot the owner is rewriting, its CAS then fails and
+// the copy is dropped. Word sized atomic accesses keep that read defined.
+typedef union {
+    pool_task_t task;
+    uintptr_t words[POOL_TASK_WORDS];
+} pool_slot_t;
+
+// Chase-Lev deque: the owner pushes and takes at bottom, thieves steal at top
+typedef struct {
+    int64_t top __attribute__((aligned(QWISTYS_CACHE_LINE)));
+    int64_t bottom __attribute__((aligned(QWISTYS_CACHE_LINE)));
+    pool_slot_t *slots __attribute__((aligned(QWISTYS_CACHE_LINE)));
+    qwistys_pool_t *pool;
+    pthread_t thread;
+    uint64_t seed; // Victim selection
+    size_t index;
+} pool_worker_t;
+
+struct qwistys_pool_t {
+    pool_worker_t *workers;
+    size_t threads;
+    qwistys_ring_t *inject;
+    int stop;
+    size_t sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+// Worker running on this thread, NULL outside any pool
+static __thread pool_worker_t *pool_current;
+
+static inline void pool_slot_write(pool_slot_t *slot, const pool_task_t *task) {
+    pool_slot_t value;
+    value.task = *task;
+    for (size_t i = 0; i < POOL_TASK_WORDS; i++) {
+        __atomic_store_n(&slot->words[i], value.words[i], __ATOMIC_RELAXED);
+    }
+}
+
+static inline void pool_slot_read(pool_slot_t *slot, pool_task_t *task) {
+    pool_slot_t value;
+    for (size_t i = 0; i < POOL_TASK_WORDS; i++) {
+        value.words[i] = __atomic_load_n(&slot->words[i], __ATOMIC_RELAXED);
+    }
+    *task = value.task;
+}
+
+static inline pool_slot_t *pool_slot(pool_worker_t *worker, int64_t index) {
+    return &worker->slots[(uint64_t)index & (QWISTYS_POOL_DEQUE_SIZE - 1)];
+}
+
+static int pool_deque_push(pool_worker_t *worker, const pool_task_t *task) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= QWISTYS_POOL_DEQUE_SIZE) {
+        return -1;
+    }
+    pool_slot_write(pool_slot(worker, bottom), task);
+    // Pairs with the acquire load of bottom in steal
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int pool_deque_take(pool_worker_t *worker, pool_task_t *task) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    pool_slot_read(pool_slot(worker, bottom), task);
+    if (top == bottom) {
+        // Last task, race the thieves for it
+        int won = __atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST,
+                                              __ATOMIC_RELAXED);
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return 1;
+}
+
+static int pool_deque_steal(pool_worker_t *worker, pool_task_t *task) {
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return 0;
+    }
+    pool_slot_read(pool_slot(worker, top), task);
+    return __atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void pool_execute(qwistys_pool_t *pool, pool_task_t *task) {
+    qwistys_task_group_t *group = task->group;
+    task->run(pool, task);
+    if (group) {
+        __atomic_sub_fetch(&group->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Own deque first (newest task, still in cache), then outside spawns, then
+// the oldest task of another worker
+static int pool_find_task(qwistys_pool_t *pool, pool_worker_t *self, pool_task_t *task) {
+    if (self && pool_deque_take(self, task)) {
+        return 1;
+    }
+    if (qwistys_ring_dequeue(pool->inject, task) == 0) {
+        return 1;
+    }
+    uint64_t seed = self ? self->seed : (uint64_t)(uintptr_t)task;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    if (self) {
+        self->seed = seed;
+    }
+    size_t start = (size_t)(seed % pool->threads);
+    for (size_t i = 0; i < pool->threads; i++) {
+        pool_worker_t *victim = &pool->workers[(start + i) % pool->threads];
+        if (victim != self && pool_deque_steal(victim, task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether any deque or the inject ring holds a task, without taking it
+static int pool_has_work(qwistys_pool_t *pool) {
+    if (qwistys_ring_size(pool->inject) != 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < pool->threads; i++) {
+        pool_worker_t *worker = &pool->workers[i];
+        if (__atomic_load_n(&worker->top, __ATOMIC_ACQUIRE) <
+            __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void pool_submit(qwistys_pool_t *pool, pool_task_t *task) {
+    if (task->group) {
+        __atomic_add_fetch(&task->group->pending, 1, __ATOMIC_RELAXED);
+    }
+    pool_worker_t *self = pool_current;
+    int queued = self && self->pool == pool ? pool_deque_push(self, task) == 0
+                                            : qwistys_ring_enqueue(pool->inject, task) == 0;
+    if (!queued) {
+        // Full: running it here is what the deque would have done eventually
+        pool_execute(pool, task);
+        return;
+    }
+    // Either this sees the sleeper or the sleeper's recheck sees the task
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *pool_worker_main(void *arg) {
+    pool_worker_t *self = (pool_worker_t *)arg;
+    qwistys_pool_t *pool = self->pool;
+    pool_current = self;
+
+    unsigned idle = 0;
+    pool_task_t task;
+    while (!__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+        if (pool_find_task(pool, self, &task)) {
+            pool_execute(pool, &task);
+            idle = 0;
+        } else if (++idle < POOL_IDLE_SPINS) {
+            sched_yield();
+        } else {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += POOL_SLEEP_NS;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_mutex_lock(&pool->lock);
+            __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+            // A spawn that read sleepers before the increment queued its
+            // task first, look again before waiting for a signal
+            if (!__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE) && !pool_has_work(pool)) {
+                pthread_cond_timedwait(&pool->wake, &pool->lock, &until);
+            }
+            __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&pool->lock);
+            idle = 0;
+        }
+    }
+    return NULL;
+}
+
+qwistys_pool_t *qwistys_pool_init(size_t threads) {
+    QWISTYS_TELEMETRY_START();
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
+    }
+
+    qwistys_pool_t *pool = (qwistys_pool_t *)qwistys_malloc(sizeof(qwistys_pool_t), NULL);
+    if (!pool) {
+        QWISTYS_HALT("Memory allocation failed for pool");
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    pool->threads = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pool->inject = qwistys_ring_init(sizeof(pool_task_t), QWISTYS_POOL_INJECT_SIZE, QWISTYS_RING_MPMC);
+    pool->workers = (pool_worker_t *)qwistys_aligned_alloc(QWISTYS_CACHE_LINE, threads * sizeof(pool_worker_t), NULL);
+    if (!pool->inject || !pool->workers) {
+        QWISTYS_HALT("Memory allocation failed for pool workers");
+        return NULL;
+    }
+    memset(pool->workers, 0, threads * sizeof(pool_worker_t));
+
+    for (size_t i = 0; i < threads; i++) {
+        pool_worker_t *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->seed = 0x9E3779B97F4A7C15ull * (i + 1);
+        worker->slots = (pool_slot_t *)qwistys_malloc(QWISTYS_POOL_DEQUE_SIZE * sizeof(pool_slot_t), NULL);
+        if (!worker->slots) {
+            QWISTYS_HALT("Memory allocation failed for pool deque");
+            return NULL;
+        }
+    }
+    // Started after every deque exists, workers steal from each other at once
+    for (size_t i = 0; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, pool_worker_main, &pool->workers[i]) != 0) {
+            QWISTYS_HALT("Failed to start pool worker");
+            return NULL;
+        }
+    }
+
+    QWISTYS_DEBUG_MSG("Pool started with %zu workers", threads);
+    QWISTYS_TELEMETRY_END();
+    return pool;
+}
+
+void qwistys_pool_free(qwistys_pool_t *pool) {
+    QWISTYS_ASSERT(pool != NULL);
+    QWISTYS_TELEMETRY_START();
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        qwistys_free(pool->workers[i].slots);
+    }
+    qwistys_aligned_free(pool->workers);
+    qwistys_ring_free(pool->inject);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    qwistys_free(pool);
+
+    QWISTYS_DEBUG_MSG("Pool stopped");
+    QWISTYS_TELEMETRY_END();
+}
+
+size_t qwistys_pool_threads(qwistys_pool_t *pool) {
+    QWISTYS_ASSERT(pool != NULL);
+    return pool->threads;
+}
+
+static void pool_run_user(qwistys_pool_t *pool, pool_task_t *task) {
+    (void)pool;
+    task->fn(task->arg);
+}
+
+void qwistys_pool_spawn(qwistys_pool_t *pool, qwistys_task_group_t *group, qwistys_task_fn fn, void *arg) {
+    QWISTYS_ASSERT(pool != NULL);
+    QWISTYS_ASSERT(group != NULL);
+    QWISTYS_ASSERT(fn != NULL);
+
+    pool_task_t task = {pool_run_user, group, fn, arg, 0, 0};
+    pool_submit(pool, &task);
+}
+
+void qwistys_pool_sync(qwistys_pool_t *pool, qwistys_task_group_t *group) {
+    QWISTYS_ASSERT(pool != NULL);
+    QWISTYS_ASSERT(group != NULL);
+
+    pool_worker_t *self = pool_current && pool_current->pool == pool ? pool_current : NULL;
+    pool_task_t task;
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) != 0) {
+        // Help instead of blocking, the tasks this waits for may be queued behind us
+        if (pool_find_task(pool, self, &task)) {
+            pool_execute(pool, &task);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+typedef struct {
+    qwistys_range_fn body;
+    void *ctx;
+    size_t grain;
+} pool_range_t;
+
+// Splits off the upper half as a task until the rest fits the grain, so
+// thieves take the biggest pieces and the owner keeps working in order
+static void pool_run_range(qwistys_pool_t *pool, pool_task_t *task) {
+    const pool_range_t *range = (const pool_range_t *)task->arg;
+    qwistys_task_group_t group = {0};
+    size_t begin = task->begin;
+    size_t end = task->end;
+    while (end - begin > range->grain) {
+        size_t middle = begin + ((end - begin) / 2);
+        pool_task_t upper = {pool_run_range, &group, NULL, task->arg, middle, end};
+        pool_submit(pool, &upper);
+        end = middle;
+    }
+    range->body(begin, end, range->ctx);
+    qwistys_pool_sync(pool, &group);
+}
+
+void qwistys_pool_parallel_for(qwistys_pool_t *pool, size_t begin, size_t end, size_t grain,
+                               qwistys_range_fn body, void *ctx) {
+    QWISTYS_ASSERT(pool != NULL);
+    QWISTYS_ASSERT(body != NULL);
+    if (begin >= end) {
+        return;
+    }
+    QWISTYS_TELEMETRY_START();
+
+    if (grain == 0) {
+        // About 8 pieces per worker leaves room to balance uneven pieces
+        grain = QWISTYS_MAX((end - begin) / (pool->threads * 8), (size_t)1);
+    }
+    pool_range_t range = {body, ctx, grain};
+    pool_task_t task = {pool_run_range, NULL, NULL, &range, begin, end};
+    pool_run_range(pool, &task);
+
+    QWISTYS_TELEMETRY_END();
+}
+
+typedef struct {
+    qwistys_item_fn body;
+    void *ctx;
+    char *data;
+    size_t item_size;
+} pool_items_t;
+
+static void pool_run_items(size_t begin, size_t end, void *ctx) {
+    const pool_items_t *items = (const pool_items_t *)ctx;
+    for (size_t i = begin; i < end; i++) {
+        items->body(items->data + (i * items->item_size), items->ctx);
+    }
+}
+
+void qwistys_pool_parallel_for_each(qwistys_pool_t *pool, flexa_t *array, size_t grain,
+                                    qwistys_item_fn body, void *ctx) {
+    QWISTYS_ASSERT(array != NULL);
+    QWISTYS_ASSERT(body != NULL);
+
+    pool_items_t items = {body, ctx, (char *)flexa_get_raw_data(array), array->item_size};
+    qwistys_pool_parallel_for(pool, 0, flexa_size(array), grain, pool_run_items, &items);
+}
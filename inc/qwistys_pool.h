@@ -0,0 +1,49 @@
+#ifndef QWISTYS_POOL_H
+#define QWISTYS_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "qwistys_api.h"
+#include "qwistys_macros.h"
+#include "qwistys_flexa.h"
+
+// Tasks one worker deque holds, a spawn on a full deque runs the task inline
+#define QWISTYS_POOL_DEQUE_SIZE 4096
+// Tasks spawned from threads outside the pool wait here
+#define QWISTYS_POOL_INJECT_SIZE 1024
+
+typedef struct qwistys_pool_t qwistys_pool_t;
+
+typedef void (*qwistys_task_fn)(void *arg);
+typedef void (*qwistys_range_fn)(size_t begin, size_t end, void *ctx);
+typedef void (*qwistys_item_fn)(void *item, void *ctx);
+
+// Tasks spawned into a group are waited for together, zero it before use
+typedef struct {
+    size_t pending;
+} qwistys_task_group_t;
+
+// Function prototypes
+// threads 0 means one worker per online CPU
+API_IMPL qwistys_pool_t *qwistys_pool_init(size_t threads);
+// Waits for the workers to exit, spawned tasks must be synced before
+API_IMPL void qwistys_pool_free(qwistys_pool_t *pool);
+API_IMPL size_t qwistys_pool_threads(qwistys_pool_t *pool);
+// Run fn(arg) on some worker, from a worker or any other thread
+API_IMPL void qwistys_pool_spawn(qwistys_pool_t *pool, qwistys_task_group_t *group, qwistys_task_fn fn, void *arg);
+// Wait until every task of the group ran, runs pool tasks while waiting
+API_IMPL void qwistys_pool_sync(qwistys_pool_t *pool, qwistys_task_group_t *group);
+// body(begin, end, ctx) over [begin, end) split into pieces of at most grain indexes (0 picks one)
+API_IMPL void qwistys_pool_parallel_for(qwistys_pool_t *pool, size_t begin, size_t end, size_t grain,
+                                        qwistys_range_fn body, void *ctx);
+// body(item, ctx) for every item of the array, the array must not change meanwhile
+API_IMPL void qwistys_pool_parallel_for_each(qwistys_pool_t *pool, flexa_t *array, size_t grain,
+                                             qwistys_item_fn body, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QWISTYS_POOL_H
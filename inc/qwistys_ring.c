@@ -0,0 +1,201 @@
+#include "qwistys_ring.h"
+#include <string.h>
+
+// MPMC slot: sequence number then the item. A slot is free for the
+// enqueue at position pos when its sequence is pos, and holds the item of
+// pos when it is pos + 1; dequeue sets it to pos + capacity for the next lap.
+#define RING_SEQ_SIZE 8
+
+static inline size_t *ring_sequence(qwistys_ring_t *ring, size_t position) {
+    return (size_t *)(ring->slots + ((position & ring->mask) * ring->slot_size));
+}
+
+static inline char *ring_item(qwistys_ring_t *ring, size_t position) {
+    return ring->slots + ((position & ring->mask) * ring->slot_size) + RING_SEQ_SIZE;
+}
+
+// Copy count items between a buffer and the SPSC slots from position on,
+// in at most two pieces around the end of the ring
+static void ring_copy_in(qwistys_ring_t *ring, size_t position, const char *items, size_t count) {
+    size_t start = position & ring->mask;
+    size_t first = QWISTYS_MIN(count, ring->mask + 1 - start);
+    memcpy(ring->slots + (start * ring->item_size), items, first * ring->item_size);
+    memcpy(ring->slots, items + (first * ring->item_size), (count - first) * ring->item_size);
+}
+
+static void ring_copy_out(qwistys_ring_t *ring, size_t position, char *items, size_t count) {
+    size_t start = position & ring->mask;
+    size_t first = QWISTYS_MIN(count, ring->mask + 1 - start);
+    memcpy(items, ring->slots + (start * ring->item_size), first * ring->item_size);
+    memcpy(items + (first * ring->item_size), ring->slots, (count - first) * ring->item_size);
+}
+
+qwistys_ring_t *qwistys_ring_init(size_t item_size, size_t capacity, qwistys_ring_mode_t mode) {
+    return qwistys_ring_init_ex(item_size, capacity, mode, NULL);
+}
+
+qwistys_ring_t *qwistys_ring_init_ex(size_t item_size, size_t capacity, qwistys_ring_mode_t mode,
+                                     const qwistys_allocator_t *allocator) {
+    QWISTYS_ASSERT(item_size > 0);
+    QWISTYS_ASSERT(capacity > 0);
+    QWISTYS_TELEMETRY_START();
+
+    if (!allocator) {
+        allocator = qwistys_allocator_default();
+    }
+    // The indexes are cache line aligned, the struct has to be as well
+    qwistys_ring_t *ring = (qwistys_ring_t *)qwistys_aligned_alloc(QWISTYS_CACHE_LINE, sizeof(qwistys_ring_t), NULL);
+    if (!ring) {
+        QWISTYS_HALT("Memory allocation failed for ring");
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+
+    size_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    ring->item_size = item_size;
+    ring->slot_size = mode == QWISTYS_RING_MPMC ? (RING_SEQ_SIZE + item_size + 7) & ~(size_t)7 : item_size;
+    ring->mask = slots - 1;
+    ring->mode = mode;
+    ring->allocator = allocator;
+    ring->slots = (char *)allocator->alloc(allocator->context, slots * ring->slot_size);
+    if (!ring->slots) {
+        qwistys_aligned_free(ring);
+        QWISTYS_HALT("Memory allocation failed for ring slots");
+        return NULL;
+    }
+    if (mode == QWISTYS_RING_MPMC) {
+        for (size_t i = 0; i < slots; i++) {
+            *ring_sequence(ring, i) = i;
+        }
+    }
+
+    QWISTYS_DEBUG_MSG("Ring initialized with %zu slots", slots);
+    QWISTYS_TELEMETRY_END();
+    return ring;
+}
+
+void qwistys_ring_free(qwistys_ring_t *ring) {
+    QWISTYS_ASSERT(ring != NULL);
+    const qwistys_allocator_t *allocator = ring->allocator;
+    allocator->free(allocator->context, ring->slots);
+    qwistys_aligned_free(ring);
+}
+
+// Free slots for the SPSC producer, re-reads tail only when the cached one says full
+static inline size_t ring_spsc_space(qwistys_ring_t *ring, size_t head, size_t wanted) {
+    size_t capacity = ring->mask + 1;
+    size_t space = capacity - (head - ring->cached_tail);
+    if (space < wanted) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        space = capacity - (head - ring->cached_tail);
+    }
+    return space;
+}
+
+static inline size_t ring_spsc_ready(qwistys_ring_t *ring, size_t tail, size_t wanted) {
+    size_t ready = ring->cached_head - tail;
+    if (ready < wanted) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        ready = ring->cached_head - tail;
+    }
+    return ready;
+}
+
+// Claims up to count consecutive slots whose sequence matches the lap,
+// offset is 0 for enqueue (slot free) and 1 for dequeue (slot full)
+static size_t ring_mpmc_claim(qwistys_ring_t *ring, size_t *index, size_t offset, size_t count,
+                              size_t *position) {
+    size_t pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t claimed = 0;
+        while (claimed < count) {
+            size_t sequence = __atomic_load_n(ring_sequence(ring, pos + claimed), __ATOMIC_ACQUIRE);
+            if (sequence != pos + claimed + offset) {
+                break;
+            }
+            claimed++;
+        }
+        if (claimed == 0) {
+            // Behind the lap: full or empty. Ahead: another thread moved index.
+            size_t sequence = __atomic_load_n(ring_sequence(ring, pos), __ATOMIC_ACQUIRE);
+            if ((intptr_t)(sequence - (pos + offset)) < 0) {
+                return 0;
+            }
+            pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+            continue;
+        }
+        // On failure pos is reloaded
+        if (__atomic_compare_exchange_n(index, &pos, pos + claimed, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *position = pos;
+            return claimed;
+        }
+    }
+}
+
+size_t qwistys_ring_enqueue_n(qwistys_ring_t *ring, const void *items, size_t count) {
+    QWISTYS_ASSERT(ring != NULL);
+    QWISTYS_ASSERT(items != NULL || count == 0);
+
+    if (ring->mode == QWISTYS_RING_SPSC) {
+        size_t head = ring->head;
+        size_t space = ring_spsc_space(ring, head, count);
+        count = QWISTYS_MIN(count, space);
+        ring_copy_in(ring, head, (const char *)items, count);
+        __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    size_t position;
+    count = ring_mpmc_claim(ring, &ring->head, 0, count, &position);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(ring_item(ring, position + i), (const char *)items + (i * ring->item_size), ring->item_size);
+        __atomic_store_n(ring_sequence(ring, position + i), position + i + 1, __ATOMIC_RELEASE);
+    }
+    return count;
+}
+
+size_t qwistys_ring_dequeue_n(qwistys_ring_t *ring, void *items, size_t count) {
+    QWISTYS_ASSERT(ring != NULL);
+    QWISTYS_ASSERT(items != NULL || count == 0);
+
+    if (ring->mode == QWISTYS_RING_SPSC) {
+        size_t tail = ring->tail;
+        size_t ready = ring_spsc_ready(ring, tail, count);
+        count = QWISTYS_MIN(count, ready);
+        ring_copy_out(ring, tail, (char *)items, count);
+        __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    size_t position;
+    count = ring_mpmc_claim(ring, &ring->tail, 1, count, &position);
+    for (size_t i = 0; i < count; i++) {
+        memcpy((char *)items + (i * ring->item_size), ring_item(ring, position + i), ring->item_size);
+        __atomic_store_n(ring_sequence(ring, position + i), position + i + ring->mask + 1, __ATOMIC_RELEASE);
+    }
+    return count;
+}
+
+int qwistys_ring_enqueue(qwistys_ring_t *ring, const void *item) {
+    return qwistys_ring_enqueue_n(ring, item, 1) == 1 ? 0 : -1;
+}
+
+int qwistys_ring_dequeue(qwistys_ring_t *ring, void *item) {
+    return qwistys_ring_dequeue_n(ring, item, 1) == 1 ? 0 : -1;
+}
+
+size_t qwistys_ring_size(qwistys_ring_t *ring) {
+    QWISTYS_ASSERT(ring != NULL);
+    // Tail first, head only grows past it
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+size_t qwistys_ring_capacity(qwistys_ring_t *ring) {
+    QWISTYS_ASSERT(ring != NULL);
+    return ring->mask + 1;
+}
@@ -0,0 +1,56 @@
+#ifndef QWISTYS_RING_H
+#define QWISTYS_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "qwistys_api.h"
+#include "qwistys_macros.h"
+#include "qwistys_alloc.h"
+
+typedef enum {
+    QWISTYS_RING_SPSC, // One producer thread and one consumer thread
+    QWISTYS_RING_MPMC  // Any number of each, per slot sequence numbers
+} qwistys_ring_mode_t;
+
+// Bounded FIFO of fixed size items. Each side writes its own index on its
+// own cache line and keeps a cached copy of the other side's index, so it
+// only reads the shared line when the ring looks full or empty.
+typedef struct {
+    size_t head __attribute__((aligned(QWISTYS_CACHE_LINE))); // Next slot to enqueue
+    size_t cached_tail;                                       // Producer's view of tail (SPSC)
+    size_t tail __attribute__((aligned(QWISTYS_CACHE_LINE))); // Next slot to dequeue
+    size_t cached_head;                                       // Consumer's view of head (SPSC)
+    size_t item_size __attribute__((aligned(QWISTYS_CACHE_LINE)));
+    size_t slot_size; // item_size, plus the sequence number in MPMC mode
+    size_t mask;      // capacity - 1
+    qwistys_ring_mode_t mode;
+    char *slots;
+    const qwistys_allocator_t *allocator;
+} qwistys_ring_t;
+
+// Function prototypes, capacity is rounded up to a power of two
+API_IMPL qwistys_ring_t *qwistys_ring_init(size_t item_size, size_t capacity, qwistys_ring_mode_t mode);
+// allocator NULL means qwistys_allocator_default(), it must outlive the ring.
+// It provides the slots, the struct is cache line aligned and comes from qwistys_aligned_alloc.
+API_IMPL qwistys_ring_t *qwistys_ring_init_ex(size_t item_size, size_t capacity, qwistys_ring_mode_t mode,
+                                              const qwistys_allocator_t *allocator);
+API_IMPL void qwistys_ring_free(qwistys_ring_t *ring);
+// 0 on success, -1 if full
+API_IMPL int qwistys_ring_enqueue(qwistys_ring_t *ring, const void *item);
+// 0 on success, -1 if empty
+API_IMPL int qwistys_ring_dequeue(qwistys_ring_t *ring, void *item);
+// Enqueue up to count items in one claim, returns how many fit
+API_IMPL size_t qwistys_ring_enqueue_n(qwistys_ring_t *ring, const void *items, size_t count);
+// Dequeue up to count items in one claim, returns how many were taken
+API_IMPL size_t qwistys_ring_dequeue_n(qwistys_ring_t *ring, void *items, size_t count);
+// A snapshot, other threads may change it right after
+API_IMPL size_t qwistys_ring_size(qwistys_ring_t *ring);
+API_IMPL size_t qwistys_ring_capacity(qwistys_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QWISTYS_RING_H
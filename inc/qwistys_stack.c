@@ -2,16 +2,23 @@
 #include "qwistys_alloc.h"
 
 qwistys_stack_t *qwistys_stack_init(size_t item_size, size_t initial_capacity) {
+    return qwistys_stack_init_ex(item_size, initial_capacity, NULL);
+}
+
+qwistys_stack_t *qwistys_stack_init_ex(size_t item_size, size_t initial_capacity,
+                                       const qwistys_allocator_t *allocator) {
     QWISTYS_TELEMETRY_START();
-    qwistys_stack_t *stack = (qwistys_stack_t *)qwistys_malloc(sizeof(qwistys_stack_t), NULL);
+    if (!allocator) {
+        allocator = qwistys_allocator_default();
+    }
+    qwistys_stack_t *stack = (qwistys_stack_t *)allocator->alloc(allocator->context, sizeof(qwistys_stack_t));
     if (!stack) {
         QWISTYS_HALT("Memory allocation failed for stack");
         return NULL;
     }
     
-    stack->data = flexa_init(item_size, initial_capacity);
-    if (!stack->data) {
-        qwistys_free(stack);
+    if (qwistys_stack_init_inline(stack, item_size, NULL, initial_capacity, allocator) != 0) {
+        allocator->free(allocator->context, stack);
         QWISTYS_HALT("Memory allocation failed for stack data");
         return NULL;
     }
@@ -21,12 +28,24 @@ qwistys_stack_t *qwistys_stack_init(size_t item_size, size_t initial_capacity) {
     return stack;
 }
 
+int qwistys_stack_init_inline(qwistys_stack_t *stack, size_t item_size, void *buffer,
+                              size_t capacity, const qwistys_allocator_t *allocator) {
+    QWISTYS_ASSERT(stack != NULL);
+    return flexa_init_inline(&stack->data, item_size, buffer, capacity, allocator);
+}
+
+void qwistys_stack_deinit(qwistys_stack_t *stack) {
+    QWISTYS_ASSERT(stack != NULL);
+    flexa_deinit(&stack->data);
+}
+
 void qwistys_stack_free(qwistys_stack_t *stack) {
     QWISTYS_ASSERT(stack != NULL);
     QWISTYS_TELEMETRY_START();
     
-    flexa_free(stack->data);
-    qwistys_free(stack);
+    const qwistys_allocator_t *allocator = stack->data.allocator;
+    flexa_deinit(&stack->data);
+    allocator->free(allocator->context, stack);
     
     QWISTYS_DEBUG_MSG("Stack freed successfully");
     QWISTYS_TELEMETRY_END();
@@ -37,7 +56,7 @@ int qwistys_stack_push(qwistys_stack_t *stack, const void *item) {
     QWISTYS_ASSERT(item != NULL);
     QWISTYS_TELEMETRY_START();
     
-    int result = flexa_add(stack->data, item);
+    int result = flexa_add(&stack->data, item);
     
     QWISTYS_DEBUG_MSG(result == 0 ? "Item pushed to stack" : "Failed to push item to stack");
     QWISTYS_TELEMETRY_END();
@@ -55,13 +74,11 @@ int qwistys_stack_pop(qwistys_stack_t *stack, void *item) {
         return -1;
     }
     
-    size_t last_index = flexa_size(stack->data) - 1;
-    memcpy(item, flexa_get(stack->data, last_index), stack->data->item_size);
-    int result = flexa_remove(stack->data, last_index);
+    qwistys_stack_pop_unchecked(stack, item);
     
-    QWISTYS_DEBUG_MSG(result == 0 ? "Item popped from stack" : "Failed to pop item from stack");
+    QWISTYS_DEBUG_MSG("Item popped from stack");
     QWISTYS_TELEMETRY_END();
-    return result;
+    return 0;
 }
 
 int qwistys_stack_peek(qwistys_stack_t *stack, void *item) {
@@ -75,8 +92,7 @@ int qwistys_stack_peek(qwistys_stack_t *stack, void *item) {
         return -1;
     }
     
-    size_t last_index = flexa_size(stack->data) - 1;
-    memcpy(item, flexa_get(stack->data, last_index), stack->data->item_size);
+    memcpy(item, qwistys_stack_top_ptr(stack), stack->data.item_size);
     
     QWISTYS_DEBUG_MSG("Peeked at top item of stack");
     QWISTYS_TELEMETRY_END();
@@ -85,10 +101,30 @@ int qwistys_stack_peek(qwistys_stack_t *stack, void *item) {
 
 size_t qwistys_stack_size(qwistys_stack_t *stack) {
     QWISTYS_ASSERT(stack != NULL);
-    return flexa_size(stack->data);
+    return flexa_size(&stack->data);
 }
 
 int qwistys_stack_is_empty(qwistys_stack_t *stack) {
     QWISTYS_ASSERT(stack != NULL);
-    return flexa_size(stack->data) == 0;
-}
\ No newline at end of file
+    return flexa_size(&stack->data) == 0;
+}
+
+int qwistys_stack_push_n(qwistys_stack_t *stack, const void *items, size_t count) {
+    QWISTYS_ASSERT(stack != NULL);
+    QWISTYS_ASSERT(items != NULL || count == 0);
+    return flexa_add_n(&stack->data, items, count);
+}
+
+int qwistys_stack_pop_n(qwistys_stack_t *stack, void *items, size_t count) {
+    QWISTYS_ASSERT(stack != NULL);
+    QWISTYS_ASSERT(items != NULL || count == 0);
+    
+    flexa_t *data = &stack->data;
+    if (count > data->size) {
+        QWISTYS_DEBUG_MSG("Attempted to pop %zu items from stack of %zu", count, data->size);
+        return -1;
+    }
+    data->size -= count;
+    memcpy(items, (char *)data->data + (data->size * data->item_size), count * data->item_size);
+    return 0;
+}
@@ -5,22 +5,70 @@
 extern "C" {
 #endif
 
+#include <string.h>
+
 #include "qwistys_api.h"
 #include "qwistys_flexa.h"
 
 // Stack structure using flexa
 typedef struct {
-    flexa_t *data;
+    flexa_t data;
 } qwistys_stack_t;
 
+// A stack with room for N items inside it, see FLEXA_INLINE
+#define QWISTYS_STACK_INLINE(T, N)                                             \
+    struct {                                                                   \
+        qwistys_stack_t stack;                                                 \
+        T items[N];                                                            \
+    }
+
 // Function prototypes
 API_IMPL qwistys_stack_t *qwistys_stack_init(size_t item_size, size_t initial_capacity);
+// allocator NULL means qwistys_allocator_default(), it must outlive the stack
+API_IMPL qwistys_stack_t *qwistys_stack_init_ex(size_t item_size, size_t initial_capacity,
+                                                const qwistys_allocator_t *allocator);
+// Stack in caller memory, buffer holds the first capacity items (NULL to allocate them).
+// Release it with qwistys_stack_deinit, not qwistys_stack_free.
+API_IMPL int qwistys_stack_init_inline(qwistys_stack_t *stack, size_t item_size, void *buffer,
+                                       size_t capacity, const qwistys_allocator_t *allocator);
+API_IMPL void qwistys_stack_deinit(qwistys_stack_t *stack);
 API_IMPL void qwistys_stack_free(qwistys_stack_t *stack);
 API_IMPL int qwistys_stack_push(qwistys_stack_t *stack, const void *item);
 API_IMPL int qwistys_stack_pop(qwistys_stack_t *stack, void *item);
 API_IMPL int qwistys_stack_peek(qwistys_stack_t *stack, void *item);
 API_IMPL size_t qwistys_stack_size(qwistys_stack_t *stack);
 API_IMPL int qwistys_stack_is_empty(qwistys_stack_t *stack);
+// Push count items in order, the last one ends on top
+API_IMPL int qwistys_stack_push_n(qwistys_stack_t *stack, const void *items, size_t count);
+// Pop the top count items into items in push order, -1 if the stack holds fewer
+API_IMPL int qwistys_stack_pop_n(qwistys_stack_t *stack, void *items, size_t count);
+
+// Fast path: no logging, telemetry or bounds check, a pointer bump plus a copy
+
+// Top item in place, NULL if empty. Valid until the next push.
+static inline void *qwistys_stack_top_ptr(qwistys_stack_t *stack) {
+    flexa_t *data = &stack->data;
+    return data->size ? (char *)data->data + ((data->size - 1) * data->item_size) : NULL;
+}
+
+// Push that only leaves the header to grow
+static inline int qwistys_stack_push_fast(qwistys_stack_t *stack, const void *item) {
+    flexa_t *data = &stack->data;
+    if (__builtin_expect(data->size == data->capacity, 0)) {
+        return flexa_add(data, item);
+    }
+    memcpy((char *)data->data + (data->size * data->item_size), item, data->item_size);
+    data->size++;
+    return 0;
+}
+
+// Pop without the empty check, the stack must hold an item
+static inline void qwistys_stack_pop_unchecked(qwistys_stack_t *stack, void *item) {
+    flexa_t *data = &stack->data;
+    QWISTYS_ASSERT(data->size > 0);
+    data->size--;
+    memcpy(item, (char *)data->data + (data->size * data->item_size), data->item_size);
+}
 
 #ifdef __cplusplus
 }
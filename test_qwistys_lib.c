@@ -5,6 +5,677 @@
 #include "qwistys_flexa.h"
 #define QWISTYS_AVLT_IMPLEMENTATION
 #include "qwistys_avltree.h"
+#include "qwistys_stack.h"
+#include "qwistys_cstack.h"
+#include "qwistys_ring.h"
+#include "qwistys_pool.h"
+
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+FLEXA_DEFINE(int_array, int)
+
+// Every slab class takes a block and hands the same slot back right after it was freed
+static void test_alloc_slab(void) {
+    for (size_t size = 1; size <= 4000; size += 37) {
+        unsigned char* block = qwistys_malloc(size, NULL);
+        QWISTYS_ASSERT(block != NULL && ((uintptr_t)block % QWISTYS_ALLOC_ALIGNMENT) == 0);
+        QWISTYS_ASSERT(qwistys_get_allocated_size(block) == size);
+        memset(block, 0xAB, size);
+        qwistys_free(block);
+        unsigned char* again = qwistys_malloc(size, NULL);
+        QWISTYS_ASSERT(again == block);
+        qwistys_free(again);
+    }
+    char* small = qwistys_malloc(24, NULL);
+    char* large = qwistys_malloc(2000, NULL);
+    QWISTYS_ASSERT(small != large);
+    qwistys_free(large);
+    qwistys_free(small);
+    char* reused = qwistys_malloc(2000, NULL);
+    QWISTYS_ASSERT(reused == large);
+    qwistys_free(reused);
+
+}
+
+// Resizes that fit the slot or the alignment padding keep the pointer and the data
+static void test_alloc_realloc_in_place(void) {
+    unsigned char* block = qwistys_malloc(1000, NULL);
+    memset(block, 0x5A, 1000);
+    unsigned char* resized = qwistys_realloc(block, 990, NULL);
+    QWISTYS_ASSERT(resized == block);
+    resized = qwistys_realloc(block, 700, NULL);
+    QWISTYS_ASSERT(resized == block && qwistys_get_allocated_size(block) == 700);
+    QWISTYS_ASSERT(block[0] == 0x5A && block[699] == 0x5A);
+    // Less than half of the slot left in use, it moves to a smaller class
+    unsigned char* moved = qwistys_realloc(block, 100, NULL);
+    QWISTYS_ASSERT(moved != block && moved[0] == 0x5A && moved[99] == 0x5A);
+    qwistys_free(moved);
+
+    block = qwistys_malloc(10001, NULL);
+    memset(block, 0x3C, 10001);
+    resized = qwistys_realloc(block, 10005, NULL);
+    QWISTYS_ASSERT(resized == block);
+
+    QWISTYS_ASSERT(block[10000] == 0x3C && qwistys_get_allocated_size(block) == 10005);
+    block = qwistys_realloc(block, 20000, NULL);
+    QWISTYS_ASSERT(block != NULL && block[0] == 0x3C && block[10000] == 0x3C);
+    qwistys_free(block);
+}
+
+// Blocks past the threshold are mapped, end just before a guard page and resize with mremap
+static void test_alloc_mmap(void) {
+    size_t threshold = qwistys_alloc_get_mmap_threshold();
+    qwistys_alloc_set_mmap_threshold(64 * 1024);
+    QWISTYS_ASSERT(qwistys_alloc_get_mmap_threshold() == 64 * 1024);
+
+    qwistys_alloc_stats_t before;
+    qwistys_alloc_stats_t after;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    qwistys_alloc_get_stats(&before);
+    unsigned char* block = qwistys_malloc(100000, NULL);
+    qwistys_alloc_get_stats(&after);
+    // Whole pages, guard included, a libc block would hold 100000 bytes plus header and footer
+    QWISTYS_ASSERT((after.current_footprint - before.current_footprint) % page == 0);
+    memset(block, 0x77, 100000);
+
+    // Writing a little past the footer has to fault, not land in the slack of the last page
+    pid_t child = fork();
+    if (child == 0) {
+        ((volatile unsigned char*)block)[QWISTYS_ALLOC_ALIGN(100000) + 32] = 1;
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    QWISTYS_ASSERT(!(WIFEXITED(status) && WEXITSTATUS(status) == 0));
+
+    // Shrinking gives pages back without moving, growing keeps the data
+    unsigned char* shrunk = qwistys_realloc(block, 70000, NULL);
+    QWISTYS_ASSERT(shrunk == block && block[69999] == 0x77);
+
+    block = qwistys_realloc(block, 1000000, NULL);
+    QWISTYS_ASSERT(block != NULL && block[0] == 0x77 && block[69999] == 0x77);
+    memset(block, 0x11, 1000000);
+    qwistys_free(block);
+
+    qwistys_aligned_free(qwistys_aligned_alloc(4096, 100000, NULL));
+    qwistys_alloc_set_mmap_threshold(threshold);
+}
+
+static void* profiled_worker(void* arg) {
+    *(void**)arg = qwistys_malloc(1000, NULL);
+    return NULL;
+}
+
+// With a period of one byte every allocation is sampled, a thread's first one included
+static void test_heap_profile(void) {
+    const char* path = "/tmp/qwistys_heap_profile.txt";
+    int started = qwistys_heap_profile_start(1);
+    QWISTYS_ASSERT(started == 0);
+    void* from_thread = NULL;
+    pthread_t thread;
+    pthread_create(&thread, NULL, profiled_worker, &from_thread);
+    pthread_join(thread, NULL);
+    void* from_main = qwistys_malloc(2000, NULL);
+    int dumped = qwistys_heap_profile_dump(path);
+    QWISTYS_ASSERT(dumped == 0);
+
+    FILE* file = fopen(path, "r");
+    char line[512];
+    size_t counts[4] = {0};
+    size_t period = 0;
+    char* header = fgets(line, sizeof(line), file);
+    QWISTYS_ASSERT(header != NULL);
+    int fields = sscanf(line, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu", &counts[0], &counts[1],
+                        &counts[2], &counts[3], &period);
+    QWISTYS_ASSERT(fields == 5);
+    QWISTYS_ASSERT(counts[0] == 2 && counts[1] == 3000 && counts[2] == 2 && counts[3] == 3000 && period == 1);
+    int sites = 0;
+    int libraries = 0;
+    while (fgets(line, sizeof(line), file)) {
+        size_t live = 0;
+        size_t bytes = 0;
+        char frame[3] = {0};
+        if (sscanf(line, "%zu: %zu [%*u: %*u] @ %2s", &live, &bytes, frame) == 3) {
+            QWISTYS_ASSERT(live == 1 && (bytes == 1000 || bytes == 2000) && strcmp(frame, "0x") == 0);
+            sites++;
+        }
+        libraries |= strcmp(line, "MAPPED_LIBRARIES:\n") == 0;
+    }
+    QWISTYS_ASSERT(sites == 2 && libraries);
+    fclose(file);
+    unlink(path);
+
+    qwistys_free(from_thread);
+    qwistys_free(from_main);
+    qwistys_heap_profile_stop();
+}
+
+// The scrubber finds an overrun footer and a header whose size was hit, while the blocks are live
+static void test_alloc_scrub(void) {
+    qwistys_alloc_corruption_t report;
+    size_t sizes[] = {40, 5000, 100};
+    unsigned char* blocks[3];
+    qwistys_alloc_registry_enable(1);
+    for (int i = 0; i < 3; i++) {
+        blocks[i] = qwistys_malloc(sizes[i], NULL);
+    }
+    int corrupted = qwistys_alloc_scrub(SIZE_MAX, NULL);
+    QWISTYS_ASSERT(corrupted == 0);
+
+    unsigned char* footer = blocks[1] + QWISTYS_ALLOC_ALIGN(sizes[1]);
+    footer[0] ^= 0xFF;
+    corrupted = qwistys_alloc_scrub(SIZE_MAX, &report);
+    QWISTYS_ASSERT(corrupted == 1);
+    QWISTYS_ASSERT(report.pointer == blocks[1] && report.size == sizes[1] && report.site != NULL);
+    footer[0] ^= 0xFF;
+
+    // Following this size would read a megabyte past the block
+    qwistys_alloc_header_t* header = (qwistys_alloc_header_t*)blocks[2] - 1;
+    header->size += 1 << 20;
+    corrupted = qwistys_alloc_scrub(SIZE_MAX, &report);
+    QWISTYS_ASSERT(corrupted == 1);
+    QWISTYS_ASSERT(report.pointer == blocks[2] && report.size == sizes[2]);
+    header->size = sizes[2];
+
+    corrupted = qwistys_alloc_scrub(SIZE_MAX, NULL);
+    QWISTYS_ASSERT(corrupted == 0);
+    for (int i = 0; i < 3; i++) {
+
+        qwistys_free(blocks[i]);
+    }
+    qwistys_alloc_registry_enable(0);
+}
+
+#define TCACHE_TEST_SIZE 3000
+#define TCACHE_TEST_BLOCKS 4
+
+typedef struct {
+    void* cached[TCACHE_TEST_BLOCKS]; // Freed, so they sit in the thread cache at exit
+    void* kept;                       // Left for the main thread to free
+} tcache_test_t;
+
+static void* tcache_worker(void* arg) {
+    tcache_test_t* test = (tcache_test_t*)arg;
+    for (int i = 0; i < TCACHE_TEST_BLOCKS; i++) {
+        test->cached[i] = qwistys_malloc(TCACHE_TEST_SIZE, NULL);
+    }
+    for (int i = 0; i < TCACHE_TEST_BLOCKS; i++) {
+        qwistys_free(test->cached[i]);
+    }
+    test->kept = qwistys_malloc(100000, NULL);
+    return NULL;
+}
+
+// A thread's counters outlive it and its cached slots go back to the shared classes
+static void test_alloc_threads(void) {
+    qwistys_alloc_stats_t before;
+    qwistys_alloc_stats_t after;
+    tcache_test_t test;
+    qwistys_alloc_get_stats(&before);
+    pthread_t thread;
+    pthread_create(&thread, NULL, tcache_worker, &test);
+    pthread_join(thread, NULL);
+
+    qwistys_alloc_get_stats(&after);
+    QWISTYS_ASSERT(after.total_allocated - before.total_allocated == TCACHE_TEST_BLOCKS * TCACHE_TEST_SIZE + 100000);
+    QWISTYS_ASSERT(after.current_usage - before.current_usage == 100000);
+    QWISTYS_ASSERT(after.peak_usage >= after.current_usage);
+    qwistys_free(test.kept);
+    qwistys_alloc_get_stats(&after);
+    QWISTYS_ASSERT(after.current_usage == before.current_usage);
+
+    // This thread never used the class, its first refill takes the slots the
+    // exited thread flushed instead of carving new ones
+    void* reused[32];
+    int found = 0;
+    for (int i = 0; i < 32; i++) {
+        reused[i] = qwistys_malloc(TCACHE_TEST_SIZE, NULL);
+        for (int j = 0; j < TCACHE_TEST_BLOCKS; j++) {
+            found += reused[i] == test.cached[j];
+        }
+    }
+    QWISTYS_ASSERT(found == TCACHE_TEST_BLOCKS);
+    for (int i = 0; i < 32; i++) {
+        qwistys_free(reused[i]);
+    }
+}
+
+static int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int is_multiple(const void* item, void* ctx) {
+    return *(const int*)item % *(int*)ctx == 0;
+}
+
+static void* append_events(void* arg) {
+    for (int i = 0; i < 1000; i++) {
+        int added = flexa_mp_add((flexa_mp_t*)arg, &i);
+        QWISTYS_ASSERT(added == 0);
+    }
+
+    return NULL;
+}
+
+static void count_task(void* arg) {
+    __atomic_add_fetch((size_t*)arg, 1, __ATOMIC_RELAXED);
+}
+
+static void sum_range(size_t begin, size_t end, void* ctx) {
+    size_t sum = 0;
+    for (size_t i = begin; i < end; i++) {
+        sum += i;
+    }
+    __atomic_add_fetch((size_t*)ctx, sum, __ATOMIC_RELAXED);
+}
+
+static void double_item(void* item, void* ctx) {
+    (void)ctx;
+    *(int*)item *= 2;
+}
+
+// A flexa on an arena, growing the last allocation stays in place
+static void test_flexa_arena(void) {
+    qwistys_arena_t arena;
+    qwistys_allocator_t arena_allocator;
+    qwistys_arena_init(&arena, 0);
+    qwistys_arena_allocator(&arena, &arena_allocator);
+    flexa_t* array = flexa_init_ex(sizeof(int), 2, &arena_allocator);
+    for (int i = 0; i < 100; i++) {
+        int added = flexa_add(array, &i);
+        QWISTYS_ASSERT(added == 0);
+    }
+    QWISTYS_ASSERT(*(int*)flexa_get(array, 99) == 99);
+
+    flexa_free(array);
+    qwistys_arena_free(&arena);
+}
+
+// Bulk inserts and removals move the tail once, ranges outside the array are refused
+static void test_flexa_range(void) {
+    flexa_t* array = flexa_init(sizeof(int), 5);
+    int batch[] = {10, 11, 12, 13};
+    int added = flexa_add_n(array, batch, 4);
+    int inserted = flexa_insert_range(array, 0, batch, 2);
+    QWISTYS_ASSERT(added == 0 && inserted == 0);
+    QWISTYS_ASSERT(*(int*)flexa_get(array, 1) == 11 && flexa_size(array) == 6);
+    int removed = flexa_remove_range(array, 0, 2);
+    QWISTYS_ASSERT(removed == 0 && *(int*)flexa_get(array, 3) == 13);
+    int past_end = flexa_remove_range(array, 3, 2);
+    int empty_past_end = flexa_remove_range(array, 5, 0);
+    int overflowing = flexa_remove_range(array, 2, SIZE_MAX);
+    QWISTYS_ASSERT(past_end == -1 && empty_past_end == -1 && overflowing == -1 && flexa_size(array) == 4);
+    int empty_at_end = flexa_remove_range(array, 4, 0);
+    QWISTYS_ASSERT(empty_at_end == 0);
+    int resized = flexa_resize_to(array, 8);
+    QWISTYS_ASSERT(resized == 0 && *(int*)flexa_get(array, 7) == 0);
+    int shrunk = flexa_shrink_to_fit(array);
+    QWISTYS_ASSERT(shrunk == 0 && array->capacity == flexa_size(array));
+    int reserved = flexa_reserve(array, 1000);
+    QWISTYS_ASSERT(reserved == 0 && array->capacity == 1000);
+
+    flexa_free(array);
+}
+
+// FLEXA_DEFINE wrappers check the item type at compile time
+static void test_flexa_typed(void) {
+    int_array_t numbers;
+    int_array_init(&numbers, 1, NULL);
+    for (int i = 0; i < 100; i++) {
+        int_array_push(&numbers, i);
+    }
+    QWISTYS_ASSERT(*int_array_at(&numbers, 42) == 42);
+    int last = int_array_pop(&numbers);
+    QWISTYS_ASSERT(last == 99 && int_array_size(&numbers) == 99);
+
+    int_array_free(&numbers);
+}
+
+// Swap removal fills the hole from the tail, remove_if keeps the survivors in order
+static void test_flexa_remove(void) {
+    flexa_t* array = flexa_init(sizeof(int), 16);
+    for (int i = 0; i < 30; i++) {
+        flexa_add(array, &i);
+    }
+    int swapped = flexa_swap_remove(array, 0);
+    QWISTYS_ASSERT(swapped == 0 && *(int*)flexa_get(array, 0) == 29);
+    int divisor = 3;
+    size_t removed = flexa_remove_if(array, is_multiple, &divisor);
+    QWISTYS_ASSERT(removed == 9);
+
+    for (size_t i = 0; i < flexa_size(array); i++) {
+        QWISTYS_ASSERT(*(int*)flexa_get(array, i) % 3 != 0);
+    }
+    QWISTYS_ASSERT(*(int*)flexa_get(array, 1) == 1 && *(int*)flexa_get(array, 19) == 28);
+    flexa_free(array);
+}
+
+// A reserved array commits in place and refuses to grow past its reservation
+static void test_flexa_reserved(void) {
+    flexa_t* array = flexa_init_reserved(sizeof(int), 1 << 20, 0);
+    flexa_growth_t growth = {1.5, 256, 4096};
+    flexa_set_growth(array, growth);
+    for (int i = 0; i < 10000; i++) {
+        flexa_add(array, &i);
+    }
+    int* stable = flexa_get(array, 0);
+    int resized = flexa_resize_to(array, 1 << 20);
+    QWISTYS_ASSERT(resized == 0 && flexa_get(array, 0) == stable);
+    int added = flexa_add(array, stable);
+    QWISTYS_ASSERT(added == -1);
+
+    flexa_free(array);
+}
+
+// Radix and merge sort agree, binary search finds the first match
+static void test_flexa_sort(void) {
+    flexa_t* array = flexa_init(sizeof(int), 64);
+    for (int i = 0; i < 1000; i++) {
+        int value = (i * 7919) % 1000 - 500;
+        flexa_add(array, &value);
+    }
+    int sorted = flexa_radix_sort(array, 0, FLEXA_KEY_I32);
+    QWISTYS_ASSERT(sorted == 0);
+    QWISTYS_ASSERT(*(int*)flexa_get(array, 0) == -500 && *(int*)flexa_get(array, 999) == 499);
+    sorted = flexa_sort(array, compare_ints, 2);
+    QWISTYS_ASSERT(sorted == 0);
+
+    int key = 42;
+    size_t first_match = flexa_lower_bound(array, &key, compare_ints);
+    int* match = flexa_bsearch(array, &key, compare_ints);
+    QWISTYS_ASSERT(first_match == 542 && *match == 42);
+
+    flexa_free(array);
+}
+
+// Every SIMD level the CPU supports gives the scalar answers
+static void test_flexa_simd(void) {
+    flexa_t* ids = flexa_init(sizeof(uint32_t), 64);
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint32_t id = i % 100;
+        flexa_add(ids, &id);
+    }
+    flexa_t* small_ids = flexa_init(sizeof(uint32_t), 1);
+    uint32_t limit = 10;
+    uint64_t id_sum = 0;
+    uint32_t id_max = 0;
+    for (int level = FLEXA_SIMD_SCALAR; level <= FLEXA_SIMD_AVX512; level++) {
+        if (flexa_simd_set_level((flexa_simd_t)level) != 0) {
+            continue;
+        }
+        size_t found = flexa_find_u32(ids, 42);
+        size_t missing = flexa_find_u32(ids, 100);
+        QWISTYS_ASSERT(found == 42 && missing == 1000);
+        size_t matches = flexa_count_eq(ids, &limit);
+        QWISTYS_ASSERT(matches == 10);
+
+        int summed = flexa_sum(ids, FLEXA_KEY_U32, &id_sum);
+        QWISTYS_ASSERT(summed == 0 && id_sum == 49500);
+        int maxed = flexa_max(ids, FLEXA_KEY_U32, &id_max);
+        QWISTYS_ASSERT(maxed == 0 && id_max == 99);
+        small_ids->size = 0;
+        int filtered = flexa_filter_into(small_ids, ids, FLEXA_KEY_U32, FLEXA_LT, &limit);
+        QWISTYS_ASSERT(filtered == 0 && flexa_size(small_ids) == 100);
+
+    }
+    flexa_free(small_ids);
+    flexa_free(ids);
+}
+
+// Mapped array survives a reopen, growth extends the file
+static void test_flexa_mapped(void) {
+    const char* mapped_path = "/tmp/qwistys_flexa_mapped.bin";
+    flexa_t* array = flexa_open_mapped(mapped_path, sizeof(int), FLEXA_MAP_CREATE | FLEXA_MAP_TRUNCATE);
+    QWISTYS_ASSERT(array != NULL);
+    for (int i = 0; i < 5000; i++) {
+        int added = flexa_add(array, &i);
+        QWISTYS_ASSERT(added == 0);
+    }
+    flexa_free(array);
+    array = flexa_open_mapped(mapped_path, sizeof(int), FLEXA_MAP_VERIFY);
+    QWISTYS_ASSERT(array != NULL && flexa_size(array) == 5000);
+    QWISTYS_ASSERT(*(int*)flexa_get(array, 4999) == 4999);
+    flexa_free(array);
+    flexa_t* mismatched = flexa_open_mapped(mapped_path, sizeof(double), 0);
+    QWISTYS_ASSERT(mismatched == NULL);
+
+    unlink(mapped_path);
+}
+
+// Segmented array keeps item addresses across growth
+static void test_flexa_seg(void) {
+    flexa_seg_t* seg = flexa_seg_init(sizeof(int), 5);
+    int* first_item = NULL;
+    for (int i = 0; i < 1000; i++) {
+        int added = flexa_seg_add(seg, &i);
+        QWISTYS_ASSERT(added == 0);
+        if (i == 0) {
+            first_item = flexa_seg_get(seg, 0);
+        }
+    }
+    QWISTYS_ASSERT(flexa_seg_get(seg, 0) == first_item && *(int*)flexa_seg_get(seg, 777) == 777);
+    flexa_seg_iter_t seg_iter;
+    size_t seg_run = 0;
+    int seg_expected = 0;
+    flexa_seg_iter_init(&seg_iter, seg);
+    for (int* items; (items = flexa_seg_next(&seg_iter, &seg_run));) {
+        for (size_t i = 0; i < seg_run; i++) {
+            QWISTYS_ASSERT(items[i] == seg_expected);
+            seg_expected++;
+
+        }
+    }
+    QWISTYS_ASSERT(seg_expected == 1000);
+    int popped = flexa_seg_pop(seg, &seg_expected);
+    QWISTYS_ASSERT(popped == 0 && seg_expected == 999);
+
+    flexa_seg_free(seg);
+}
+
+// Inline arrays live in the caller struct until they spill
+static void test_flexa_inline(void) {
+    QWISTYS_ASSERT(sizeof(flexa_t) == 64);
+    FLEXA_INLINE(int, 8) small;
+    int initialized = flexa_init_inline(&small.array, sizeof(int), small.items, 8, NULL);
+    QWISTYS_ASSERT(initialized == 0);
+
+    for (int i = 0; i < 8; i++) {
+        flexa_add(&small.array, &i);
+    }
+    QWISTYS_ASSERT(small.array.data == small.items);
+    // An own growth policy is released by flexa_deinit
+    flexa_growth_t growth = {1.0, 4, 0};
+    flexa_set_growth(&small.array, growth);
+    for (int i = 8; i < 20; i++) {
+        flexa_add(&small.array, &i);
+    }
+    QWISTYS_ASSERT(small.array.data != small.items && *(int*)flexa_get(&small.array, 19) == 19);
+    QWISTYS_ASSERT(small.array.capacity == 20);
+    flexa_deinit(&small.array);
+}
+
+// Producers append concurrently, every item is published once
+static void test_flexa_mp(void) {
+    flexa_mp_t* events = flexa_mp_init(sizeof(int), 16);
+    pthread_t producers[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&producers[i], NULL, append_events, events);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    int event_sum = 0;
+    QWISTYS_ASSERT(flexa_mp_published(events) == 4000);
+    for (size_t i = 0; i < flexa_mp_published(events); i++) {
+        event_sum += *(int*)flexa_mp_get(events, i);
+    }
+    QWISTYS_ASSERT(event_sum == 4 * 499500);
+    flexa_mp_free(events);
+}
+
+// Struct of arrays, one column per field
+static void test_flexa_soa(void) {
+    size_t particle_fields[] = {sizeof(float), sizeof(uint64_t)};
+    flexa_soa_t* particles = flexa_soa_init(particle_fields, 2, 2);
+    for (int i = 0; i < 10; i++) {
+        float mass = (float)i;
+        uint64_t tag = 100 + (uint64_t)i;
+        const void* row[] = {&mass, &tag};
+        int added = flexa_soa_add(particles, row);
+        QWISTYS_ASSERT(added == 0);
+    }
+    int removed = flexa_soa_swap_remove(particles, 2);
+    QWISTYS_ASSERT(removed == 0 && flexa_soa_size(particles) == 9);
+
+    float* masses = flexa_soa_column(particles, 0);
+    QWISTYS_ASSERT(masses[2] == 9.0f && masses[3] == 3.0f);
+    uint64_t particle_tag = 0;
+    void* particle_row[] = {NULL, &particle_tag};
+    flexa_soa_get_row(particles, 2, particle_row);
+    QWISTYS_ASSERT(particle_tag == 109 && *(uint64_t*)flexa_soa_at(particles, 1, 0) == 100);
+    flexa_soa_free(particles);
+}
+
+// An inline stack spills past its buffer, the batch and unchecked paths skip the per item checks
+static void test_stack_inline(void) {
+    int value = 0;
+    QWISTYS_STACK_INLINE(int, 4) small_stack;
+    qwistys_stack_init_inline(&small_stack.stack, sizeof(int), small_stack.items, 4, NULL);
+    for (int i = 0; i < 6; i++) {
+        qwistys_stack_push(&small_stack.stack, &i);
+    }
+    int result = qwistys_stack_pop(&small_stack.stack, &value);
+    QWISTYS_ASSERT(result == 0 && value == 5);
+    int pushed[] = {1, 2, 3};
+    int popped[3] = {0};
+    result = qwistys_stack_push_n(&small_stack.stack, pushed, 3);
+    QWISTYS_ASSERT(result == 0 && *(int*)qwistys_stack_top_ptr(&small_stack.stack) == 3);
+    result = qwistys_stack_pop_n(&small_stack.stack, popped, 3);
+    QWISTYS_ASSERT(result == 0 && popped[0] == 1 && popped[2] == 3);
+    result = qwistys_stack_push_fast(&small_stack.stack, &value);
+    QWISTYS_ASSERT(result == 0);
+    qwistys_stack_pop_unchecked(&small_stack.stack, &value);
+    QWISTYS_ASSERT(value == 5 && qwistys_stack_size(&small_stack.stack) == 5);
+    result = qwistys_stack_pop_n(&small_stack.stack, popped, 6);
+    QWISTYS_ASSERT(result == -1);
+
+    qwistys_stack_deinit(&small_stack.stack);
+}
+
+// Bounded stacks refuse a push past capacity, growing ones reuse popped nodes
+static void test_cstack(void) {
+    int value = 7;
+    int key = 42;
+    qwistys_cstack_t* shared_stack = qwistys_cstack_init_bounded(sizeof(int), 2, NULL);
+    int first = qwistys_cstack_push(shared_stack, &value);
+    int second = qwistys_cstack_push(shared_stack, &key);
+    int third = qwistys_cstack_push(shared_stack, &value);
+    QWISTYS_ASSERT(first == 0 && second == 0 && third == -1);
+    int result = qwistys_cstack_peek(shared_stack, &value);
+    QWISTYS_ASSERT(result == 0 && value == key);
+    result = qwistys_cstack_pop(shared_stack, &value);
+    QWISTYS_ASSERT(result == 0 && qwistys_cstack_size(shared_stack) == 1);
+    qwistys_cstack_free(shared_stack);
+
+    // A growing stack recycles popped nodes through the thread's cache slot
+    shared_stack = qwistys_cstack_init(sizeof(int), 1);
+    for (int i = 0; i < 3; i++) {
+        result = qwistys_cstack_push(shared_stack, &i);
+        QWISTYS_ASSERT(result == 0);
+    }
+    result = qwistys_cstack_pop(shared_stack, &value);
+    QWISTYS_ASSERT(result == 0 && value == 2);
+    result = qwistys_cstack_push(shared_stack, &key);
+    QWISTYS_ASSERT(result == 0 && shared_stack->allocated == 3);
+    QWISTYS_ASSERT(qwistys_cstack_size(shared_stack) == 3);
+    result = qwistys_cstack_pop(shared_stack, &value);
+    QWISTYS_ASSERT(result == 0 && value == key);
+    for (int expected = 1; expected >= 0; expected--) {
+        result = qwistys_cstack_pop(shared_stack, &value);
+        QWISTYS_ASSERT(result == 0 && value == expected);
+    }
+    result = qwistys_cstack_pop(shared_stack, &value);
+    QWISTYS_ASSERT(result == -1);
+    QWISTYS_ASSERT(qwistys_cstack_is_empty(shared_stack) && qwistys_cstack_size(shared_stack) == 0);
+    qwistys_cstack_free(shared_stack);
+
+    // Items that are not a multiple of 8 bytes are copied whole
+    char name[13] = "twelve chars";
+    char copy[13] = {0};
+    shared_stack = qwistys_cstack_init(sizeof(name), 4);
+    result = qwistys_cstack_push(shared_stack, name);
+    QWISTYS_ASSERT(result == 0);
+    result = qwistys_cstack_peek(shared_stack, copy);
+    QWISTYS_ASSERT(result == 0 && memcmp(copy, name, sizeof(name)) == 0);
+
+    qwistys_cstack_free(shared_stack);
+}
+
+// Every ring mode rounds the capacity up, refuses a full enqueue and keeps FIFO order
+static void test_ring(void) {
+    int value = 0;
+    for (int mode = QWISTYS_RING_SPSC; mode <= QWISTYS_RING_MPMC; mode++) {
+        qwistys_ring_t* ring = qwistys_ring_init(sizeof(int), 3, (qwistys_ring_mode_t)mode);
+        int queued[] = {1, 2, 3, 4, 5};
+        int dequeued[5] = {0};
+        QWISTYS_ASSERT(qwistys_ring_capacity(ring) == 4);
+        size_t moved = qwistys_ring_enqueue_n(ring, queued, 5);
+        int result = qwistys_ring_enqueue(ring, &value);
+        QWISTYS_ASSERT(moved == 4 && result == -1);
+        result = qwistys_ring_dequeue(ring, &value);
+        QWISTYS_ASSERT(result == 0 && value == 1);
+        result = qwistys_ring_enqueue(ring, &queued[4]);
+        QWISTYS_ASSERT(result == 0 && qwistys_ring_size(ring) == 4);
+        moved = qwistys_ring_dequeue_n(ring, dequeued, 5);
+        QWISTYS_ASSERT(moved == 4 && dequeued[0] == 2 && dequeued[3] == 5);
+        result = qwistys_ring_dequeue(ring, &value);
+        QWISTYS_ASSERT(result == -1);
+
+        qwistys_ring_free(ring);
+    }
+}
+
+// Spawned tasks, a parallel loop and a parallel for_each all run exactly once
+static void test_pool(void) {
+    qwistys_pool_t* pool = qwistys_pool_init(3);
+    QWISTYS_ASSERT(qwistys_pool_threads(pool) == 3);
+    qwistys_task_group_t group = {0};
+    size_t ran = 0;
+    for (int i = 0; i < 10000; i++) {
+        qwistys_pool_spawn(pool, &group, count_task, &ran);
+    }
+    qwistys_pool_sync(pool, &group);
+    QWISTYS_ASSERT(ran == 10000 && group.pending == 0);
+    size_t sum = 0;
+    qwistys_pool_parallel_for(pool, 0, 100000, 0, sum_range, &sum);
+    QWISTYS_ASSERT(sum == (size_t)100000 * 99999 / 2);
+    flexa_t* doubled = flexa_init(sizeof(int), 16);
+    for (int i = 0; i < 1000; i++) {
+        flexa_add(doubled, &i);
+    }
+    qwistys_pool_parallel_for_each(pool, doubled, 16, double_item, NULL);
+    QWISTYS_ASSERT(*(int*)flexa_get(doubled, 999) == 1998);
+    flexa_free(doubled);
+    qwistys_pool_free(pool);
+}
+
+// The largest accepted alignment survives a realloc, the next one is refused
+static void test_alloc_max_alignment(void) {
+    size_t largest = QWISTYS_MIN((size_t)sysconf(_SC_PAGESIZE), QWISTYS_ALLOC_MAX_ALIGNMENT);
+    char* block = qwistys_aligned_alloc(largest, 100, NULL);
+    QWISTYS_ASSERT(block != NULL && ((uintptr_t)block % largest) == 0);
+    memset(block, 0x5A, 100);
+    block = qwistys_realloc(block, 3 * largest, NULL);
+    QWISTYS_ASSERT(block != NULL && ((uintptr_t)block % largest) == 0);
+    QWISTYS_ASSERT(block[0] == 0x5A && block[99] == 0x5A);
+    qwistys_aligned_free(block);
+    void* refused = qwistys_aligned_alloc(largest * 2, 100, NULL);
+    QWISTYS_ASSERT(refused == NULL);
+}
 
 int main() {
     QWISTYS_DEBUG_MSG("______________ ALLOC TEST ______________________");
@@ -21,8 +692,45 @@ int main() {
     // memcpy(pointer, &pdata, sizeof(uint64_t));
 
     qwistys_free(pointer);
+    test_alloc_threads(); // First, it needs a size class the main thread has not cached yet
+    test_alloc_slab();
+    test_alloc_realloc_in_place();
+    test_alloc_mmap();
+    test_heap_profile();
+    test_alloc_scrub();
+
+    double* aligned = qwistys_aligned_alloc(64, sizeof(double) * 8, NULL);
+    QWISTYS_ASSERT(aligned != NULL && ((uintptr_t)aligned % 64) == 0);
+    aligned = qwistys_realloc(aligned, sizeof(double) * 1024, NULL);
+    QWISTYS_ASSERT(aligned != NULL && ((uintptr_t)aligned % 64) == 0);
+    qwistys_aligned_free(aligned);
+    test_alloc_max_alignment();
 
     QWISTYS_DEBUG_MSG("______________ ALLOC END ______________________");
+    QWISTYS_DEBUG_MSG("______________ ARENA TEST ______________________");
+    qwistys_arena_t arena;
+    qwistys_arena_init(&arena, 256);
+
+    int* first = qwistys_arena_alloc(&arena, sizeof(int));
+    QWISTYS_ASSERT(first != NULL);
+    qwistys_arena_mark_t mark = qwistys_arena_mark(&arena);
+    for (int i = 0; i < 100; i++) {
+        int* scratch = qwistys_arena_alloc(&arena, sizeof(int) * 4);
+        QWISTYS_ASSERT(scratch != NULL);
+        QWISTYS_ASSERT(((uintptr_t)scratch % QWISTYS_ALLOC_ALIGNMENT) == 0);
+    }
+    qwistys_arena_rewind(&arena, mark);
+    int* rewound = qwistys_arena_alloc(&arena, sizeof(int));
+    QWISTYS_ASSERT(rewound == first + QWISTYS_ALLOC_ALIGNMENT / sizeof(int));
+
+    qwistys_arena_reset(&arena);
+    int* reset = qwistys_arena_alloc(&arena, sizeof(int));
+    QWISTYS_ASSERT(reset == first);
+    void* spilled = qwistys_arena_alloc(&arena, 4096);
+    QWISTYS_ASSERT(spilled != NULL);
+
+    qwistys_arena_free(&arena);
+    QWISTYS_DEBUG_MSG("______________ ARENA END ______________________");
     QWISTYS_DEBUG_MSG("______________ BITWISE TEST ______________________");
     uint32_t bitfield = 0;
 
@@ -68,6 +776,23 @@ int main() {
 
     flexa_free(array);
 
+    test_flexa_arena();
+    test_flexa_range();
+    test_flexa_typed();
+    test_flexa_remove();
+    test_flexa_reserved();
+    test_flexa_sort();
+    test_flexa_simd();
+    test_flexa_mapped();
+    test_flexa_seg();
+    test_flexa_inline();
+    test_flexa_mp();
+    test_flexa_soa();
+    test_stack_inline();
+    test_cstack();
+    test_ring();
+    test_pool();
+
     QWISTYS_DEBUG_MSG("______________ FLEXA END ______________________");
 
     QWISTYS_DEBUG_MSG("______________  AVL TREE TEST ______________________");